@@ -0,0 +1,69 @@
+/**
+ * \file
+ *         Periodic Energest report, see energest-report.h
+ */
+#include "contiki.h"
+#include "sys/energest.h"
+#include "energest-report.h"
+#include <stdio.h>
+
+/*---------------------------------------------------------------------------*/
+PROCESS(energest_report_process, "Energest report");
+
+static clock_time_t report_interval;
+
+/*---------------------------------------------------------------------------*/
+void
+energest_report_start(clock_time_t interval)
+{
+    report_interval = interval;
+    process_start(&energest_report_process, NULL);
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(energest_report_process, ev, data)
+{
+    static struct etimer et;
+    static unsigned long old_cpu, old_lpm, old_listen, old_transmit;
+
+    PROCESS_BEGIN();
+
+    etimer_set(&et, report_interval);
+    while(1) {
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+        etimer_reset(&et);
+        energest_flush();
+
+        unsigned long cpu = energest_type_time(ENERGEST_TYPE_CPU) - old_cpu;
+        unsigned long lpm = energest_type_time(ENERGEST_TYPE_LPM) - old_lpm;
+        unsigned long listen = energest_type_time(ENERGEST_TYPE_LISTEN) - old_listen;
+        unsigned long transmit = energest_type_time(ENERGEST_TYPE_TRANSMIT) - old_transmit;
+        unsigned long total = cpu + lpm;
+
+        old_cpu += cpu;
+        old_lpm += lpm;
+        old_listen += listen;
+        old_transmit += transmit;
+
+        if(total == 0) {
+            continue;
+        }
+
+        /* per mille of the interval each component was on */
+        unsigned long cpu_pm = cpu * 1000 / total;
+        unsigned long lpm_pm = lpm * 1000 / total;
+        unsigned long listen_pm = listen * 1000 / total;
+        unsigned long transmit_pm = transmit * 1000 / total;
+
+        /* average power in microwatts at 3V with the currents from the tmote sky data sheet:
+           cpu 1800uA, lpm 54.5uA, radio rx 19700uA, radio tx 17400uA */
+        unsigned long power = 3 * (cpu_pm * 1800 + lpm_pm * 55 + listen_pm * 19700 + transmit_pm * 17400) / 1000;
+
+        printf("ENERGY cpu %lu lpm %lu listen %lu transmit %lu (ms), radio duty cycle %lu.%lu%%, power %lu (uW)\n",
+               cpu * 1000 / RTIMER_SECOND, lpm * 1000 / RTIMER_SECOND,
+               listen * 1000 / RTIMER_SECOND, transmit * 1000 / RTIMER_SECOND,
+               (listen_pm + transmit_pm) / 10, (listen_pm + transmit_pm) % 10, power);
+    }
+
+    PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
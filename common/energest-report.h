@@ -0,0 +1,23 @@
+/**
+ * \file
+ *         Periodic Energest report, shared by the applications that compare radio profiles
+ *
+ *         Every interval one line is printed with the time the cpu and the
+ *         radio were on since the last report, the radio duty cycle and the
+ *         average power:
+ *           ENERGY cpu <ms> lpm <ms> listen <ms> transmit <ms> (ms), radio duty cycle <percent>%, power <uW> (uW)
+ *
+ *         Applications use it by adding ../common to PROJECTDIRS and
+ *         energest-report.c to PROJECT_SOURCEFILES.
+ */
+#ifndef ENERGEST_REPORT_H_
+#define ENERGEST_REPORT_H_
+
+#include "contiki.h"
+
+/**
+ * Start printing the report every interval clock ticks
+ */
+void energest_report_start(clock_time_t interval);
+
+#endif /* ENERGEST_REPORT_H_ */
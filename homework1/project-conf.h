@@ -0,0 +1,12 @@
+#ifndef PROJECT_CONF_H_
+#define PROJECT_CONF_H_
+
+/**
+ * ContikiMAC, the default RDC layer of the sky platform, schedules its channel checks with the
+ * rtimer. Only one rtimer can be pending, so the scheduler benchmark needs the radio kept on
+ * by nullrdc, which also keeps radio interrupts out of the measurements.
+ */
+#undef NETSTACK_CONF_RDC
+#define NETSTACK_CONF_RDC nullrdc_driver
+
+#endif /* PROJECT_CONF_H_ */
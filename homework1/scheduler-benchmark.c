@@ -0,0 +1,294 @@
+/*
+ * Benchmark of the Contiki event dispatcher.
+ *
+ * Measures, with rtimer timestamps:
+ *  - the latency from process_post(), process_poll() and process_post_synch() to the
+ *    moment the receiving process runs
+ *  - the dispatch throughput of a process that posts events to itself
+ *  - the latency of a timer-driven process while N busy processes spin on PROCESS_PAUSE()
+ *    like protothread2 and protothread3 do. The timer interrupt polls a relay process,
+ *    which posts an event to the timed process, the same path the clock interrupt,
+ *    etimer_process and PROCESS_EVENT_TIMER take.
+ *
+ * Results are printed as SCHED lines, "SCHED done" follows the last one:
+ *   SCHED <post|poll|post_synch> min <us> mean <us> max <us> us
+ *   SCHED throughput <events> events in <us> us, <rate> events/s
+ *   SCHED busy <N> poll min <us> mean <us> max <us> us delivery min <us> mean <us> max <us> us yields <n>
+ *
+ * Run it in Cooja (make sim) or as a native process (make native && ./scheduler-benchmark.native).
+ */
+#include <stdio.h>
+#include <string.h>
+#include "contiki.h"
+
+#ifdef CONTIKI_TARGET_NATIVE
+#include <sys/time.h>
+#endif
+
+// number of measurements per latency value
+#define SCHED_ROUNDS 100
+// number of events the throughput test posts
+#define SCHED_THROUGHPUT_EVENTS 500
+// maximum number of busy processes
+#define BUSY_MAX 8
+
+#ifdef CONTIKI_TARGET_NATIVE
+// the rtimer of the native target counts milliseconds and never fires, so the time is taken
+// from gettimeofday and the timer is an etimer of the relay process
+typedef unsigned long bench_time_t;
+#define BENCH_SECOND 1000000UL
+static bench_time_t bench_now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000UL + tv.tv_usec;
+}
+#else
+typedef rtimer_clock_t bench_time_t;
+#define BENCH_SECOND RTIMER_SECOND
+#define bench_now() RTIMER_NOW()
+// delay from arming the rtimer to the interrupt
+#define SCHED_TIMER_DELAY (RTIMER_SECOND / 100)
+#endif
+
+// converts a bench_time_t difference to microseconds without overflow for RTIMER_SECOND 32768
+#define TO_US(t) ((unsigned long)(t) * (1000000UL / 64) / (BENCH_SECOND / 64))
+
+struct latency_stats {
+	unsigned long sum;
+	bench_time_t min;
+	bench_time_t max;
+	uint16_t count;
+};
+
+// modes of the latency test
+#define MODE_POST  0
+#define MODE_POLL  1
+#define MODE_SYNCH 2
+static const char *mode_names[] = {"post", "poll", "post_synch"};
+
+// number of busy processes for the timer test
+static const uint8_t busy_loads[] = {0, 1, 2, 4, 8};
+
+PROCESS(benchmark_process, "Scheduler benchmark");
+PROCESS(sink_process, "Sink");
+PROCESS(relay_process, "Timer relay");
+PROCESS(timed_process, "Timed process");
+// template of the busy processes, it is copied for every instance
+PROCESS(busy_process, "Busy");
+
+AUTOSTART_PROCESSES(&benchmark_process);
+
+static process_event_t ping_event;
+static process_event_t self_event;
+static process_event_t done_event;
+static process_event_t tick_event;
+
+static struct process busy_processes[BUSY_MAX];
+static uint8_t busy_running;
+static unsigned long busy_yields;
+
+// timestamps of the last measurement
+static bench_time_t sent;
+static bench_time_t received;
+static bench_time_t fired;
+static bench_time_t relayed;
+static uint16_t self_events_left;
+
+#ifndef CONTIKI_TARGET_NATIVE
+static struct rtimer timer;
+#endif
+
+static void stats_reset(struct latency_stats *s) {
+	memset(s, 0, sizeof(*s));
+}
+
+static void stats_add(struct latency_stats *s, bench_time_t t) {
+	if (s->count == 0 || t < s->min) {
+		s->min = t;
+	}
+	if (t > s->max) {
+		s->max = t;
+	}
+	s->sum += t;
+	s->count++;
+}
+
+static void stats_print(const struct latency_stats *s) {
+	printf("min %lu mean %lu max %lu us", TO_US(s->min),
+		s->count > 0 ? TO_US(s->sum / s->count) : 0, TO_US(s->max));
+}
+
+#ifndef CONTIKI_TARGET_NATIVE
+// rtimer interrupt, only process_poll() may be called here
+static void timer_fired(struct rtimer *t, void *ptr) {
+	fired = bench_now();
+	process_poll(&relay_process);
+}
+#endif
+
+// arms the timer that starts one measurement of the timer test
+static void arm_timer() {
+#ifdef CONTIKI_TARGET_NATIVE
+	process_post(&relay_process, ping_event, NULL);
+#else
+	rtimer_set(&timer, RTIMER_NOW() + SCHED_TIMER_DELAY, 1, timer_fired, NULL);
+#endif
+}
+
+PROCESS_THREAD(benchmark_process, ev, data) {
+	static struct etimer et;
+	static struct latency_stats stats;
+	static struct latency_stats poll_stats;
+	static uint8_t mode;
+	static uint8_t load;
+	static uint16_t round;
+	static bench_time_t start;
+	bench_time_t elapsed;
+
+	PROCESS_BEGIN();
+
+	ping_event = process_alloc_event();
+	self_event = process_alloc_event();
+	done_event = process_alloc_event();
+	tick_event = process_alloc_event();
+
+	process_start(&sink_process, NULL);
+	process_start(&relay_process, NULL);
+	process_start(&timed_process, NULL);
+
+	// let the system finish booting
+	etimer_set(&et, CLOCK_SECOND);
+	PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+
+	printf("SCHED start, %lu ticks per second\n", (unsigned long)BENCH_SECOND);
+
+	// post, poll and synchronous post to an idle process
+	for (mode = MODE_POST; mode <= MODE_SYNCH; mode++) {
+		stats_reset(&stats);
+		for (round = 0; round < SCHED_ROUNDS; round++) {
+			sent = bench_now();
+			if (mode == MODE_POST) {
+				process_post(&sink_process, ping_event, NULL);
+			} else if (mode == MODE_POLL) {
+				process_poll(&sink_process);
+			} else {
+				process_post_synch(&sink_process, ping_event, NULL);
+			}
+			PROCESS_WAIT_EVENT_UNTIL(ev == done_event);
+			stats_add(&stats, received - sent);
+		}
+		printf("SCHED %s ", mode_names[mode]);
+		stats_print(&stats);
+		printf("\n");
+	}
+
+	// the sink posts SCHED_THROUGHPUT_EVENTS events to itself
+	self_events_left = SCHED_THROUGHPUT_EVENTS;
+	start = bench_now();
+	process_post(&sink_process, self_event, NULL);
+	PROCESS_WAIT_EVENT_UNTIL(ev == done_event);
+	// with a 16 bit rtimer this is only right if the test takes less than two seconds
+	elapsed = received - start;
+	if (elapsed > 0) {
+		printf("SCHED throughput %u events in %lu us, %lu events/s\n", SCHED_THROUGHPUT_EVENTS,
+			TO_US(elapsed), (unsigned long)SCHED_THROUGHPUT_EVENTS * BENCH_SECOND / elapsed);
+	}
+
+	// timer-driven process with a growing number of busy processes
+	for (load = 0; load < sizeof(busy_loads); load++) {
+		while (busy_running < busy_loads[load]) {
+			memcpy(&busy_processes[busy_running], &busy_process, sizeof(struct process));
+			process_start(&busy_processes[busy_running], NULL);
+			busy_running++;
+		}
+		busy_yields = 0;
+		stats_reset(&stats);
+		stats_reset(&poll_stats);
+		for (round = 0; round < SCHED_ROUNDS; round++) {
+			arm_timer();
+			PROCESS_WAIT_EVENT_UNTIL(ev == done_event);
+			stats_add(&poll_stats, relayed - fired);
+			stats_add(&stats, received - fired);
+		}
+		printf("SCHED busy %u poll ", busy_running);
+		stats_print(&poll_stats);
+		printf(" delivery ");
+		stats_print(&stats);
+		printf(" yields %lu\n", busy_yields);
+	}
+
+	while (busy_running > 0) {
+		busy_running--;
+		process_exit(&busy_processes[busy_running]);
+	}
+
+	printf("SCHED done\n");
+
+	PROCESS_END();
+}
+
+// receives the events of the latency and throughput tests
+PROCESS_THREAD(sink_process, ev, data) {
+	PROCESS_BEGIN();
+
+	while (1) {
+		PROCESS_WAIT_EVENT();
+		received = bench_now();
+		if (ev == self_event) {
+			self_events_left--;
+			if (self_events_left > 0) {
+				process_post(PROCESS_CURRENT(), self_event, NULL);
+				continue;
+			}
+		}
+		process_post(&benchmark_process, done_event, NULL);
+	}
+
+	PROCESS_END();
+}
+
+// stands in for etimer_process: is polled by the timer and posts the tick to the timed process
+PROCESS_THREAD(relay_process, ev, data) {
+#ifdef CONTIKI_TARGET_NATIVE
+	static struct etimer et;
+#endif
+	PROCESS_BEGIN();
+
+	while (1) {
+#ifdef CONTIKI_TARGET_NATIVE
+		PROCESS_WAIT_EVENT_UNTIL(ev == ping_event);
+		etimer_set(&et, 1);
+		PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+		fired = bench_now();
+#else
+		PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL);
+#endif
+		relayed = bench_now();
+		process_post(&timed_process, tick_event, NULL);
+	}
+
+	PROCESS_END();
+}
+
+PROCESS_THREAD(timed_process, ev, data) {
+	PROCESS_BEGIN();
+
+	while (1) {
+		PROCESS_WAIT_EVENT_UNTIL(ev == tick_event);
+		received = bench_now();
+		process_post(&benchmark_process, done_event, NULL);
+	}
+
+	PROCESS_END();
+}
+
+PROCESS_THREAD(busy_process, ev, data) {
+	PROCESS_BEGIN();
+
+	while (1) {
+		busy_yields++;
+		PROCESS_PAUSE();
+	}
+
+	PROCESS_END();
+}
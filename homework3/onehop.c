@@ -1,36 +1,173 @@
 #include <stdio.h>
+#include <string.h>
 #include "contiki.h"
 #include "dev/button-sensor.h"
 #include "dev/leds.h"
 
 #include "net/rime/rime.h"
+#include "random.h"
+#include "energest-report.h"
 
 PROCESS(pt_btn, "Handle button presses");
 PROCESS(pt_listen, "Listen Alarm");
+PROCESS(pt_energy, "Radio profile report");
 
-AUTOSTART_PROCESSES(&pt_btn);
+AUTOSTART_PROCESSES(&pt_btn, &pt_energy);
 
 static struct broadcast_conn broadcast;
 
+// group the button of this node raises the alarm for
+#ifndef ALARM_SEND_GROUP
+#define ALARM_SEND_GROUP 15
+#endif
+
+// groups this node reacts to, a comma separated list
+#ifndef ALARM_SUBSCRIBED_GROUPS
+#define ALARM_SUBSCRIBED_GROUPS 15
+#endif
+
+// groups this node re-broadcasts for because members are further away, a comma separated list
+// set from the Makefile (make RELAY_GROUPS=15,16), not defined means no relaying
+
+// a relay waits a random time up to this before it re-broadcasts, so relays that heard the same alarm do not collide
+#define ALARM_RELAY_JITTER (CLOCK_SECOND / 8)
+
+// number of alarms waiting for their relay jitter, further alarms are dropped instead of relayed
+#define ALARM_RELAY_QUEUE_SIZE 4
+
+// maximum number of times an alarm is re-broadcast
+#ifndef ALARM_MAX_HOPS
+#define ALARM_MAX_HOPS 3
+#endif
+
+// number of (origin, seq no) pairs remembered to drop alarms that were already relayed
+#define ALARM_SEEN_SIZE 8
+
 struct collect_msg {
 	char *identifier;
 	uint8_t group_id;
 	uint8_t alert;
+	uint16_t seq_no; // incremented for every alarm sent, used to match send and receive in the logs
+	linkaddr_t origin; // node that raised the alarm
+	uint8_t ttl; // remaining number of re-broadcasts
 };
 
+/**
+ * One bit per group id, 32 bytes cover every possible uint8_t group id
+*/
+struct group_set {
+	uint8_t bits[32];
+};
+
+static struct group_set subscribed_groups;
+static struct group_set relay_groups;
+
+// alarms waiting for their relay jitter to pass, sent one after the other from relay_timer
+static struct collect_msg relay_queue[ALARM_RELAY_QUEUE_SIZE];
+static uint8_t relay_head = 0;
+static uint8_t relay_count = 0;
+static struct ctimer relay_timer;
+
+static struct {
+	linkaddr_t origin;
+	uint16_t seq_no;
+} seen_alarms[ALARM_SEEN_SIZE];
+static uint8_t seen_next = 0;
+
+static void group_add(struct group_set *set, uint8_t group_id) {
+	set->bits[group_id >> 3] |= 1 << (group_id & 7);
+}
+
+static int group_contains(const struct group_set *set, uint8_t group_id) {
+	return set->bits[group_id >> 3] & (1 << (group_id & 7));
+}
+
+static void group_add_all(struct group_set *set, const uint8_t *group_ids, uint8_t count) {
+	uint8_t i;
+	memset(set, 0, sizeof(struct group_set));
+	for (i = 0; i < count; i++) {
+		group_add(set, group_ids[i]);
+	}
+}
+
+/**
+ * Remember an alarm, returns 0 if it was seen before
+*/
+static int alarm_is_new(const struct collect_msg *msg) {
+	uint8_t i;
+	for (i = 0; i < ALARM_SEEN_SIZE; i++) {
+		if (seen_alarms[i].seq_no == msg->seq_no && linkaddr_cmp(&seen_alarms[i].origin, &msg->origin)) {
+			return 0;
+		}
+	}
+	linkaddr_copy(&seen_alarms[seen_next].origin, &msg->origin);
+	seen_alarms[seen_next].seq_no = msg->seq_no;
+	seen_next = (seen_next + 1) % ALARM_SEEN_SIZE;
+	return 1;
+}
+
 /**
  * O means alram is off, 1 means alram is on
 */
 static int alarm = 0; 
 static struct etimer et;
 
+static void send_relayed(void *ptr) {
+	struct collect_msg *msg = &relay_queue[relay_head];
+	packetbuf_copyfrom(msg, sizeof(struct collect_msg));
+	broadcast_send(&broadcast);
+	printf("Alarm relayed for group %u\n", msg->group_id);
+
+	relay_head = (relay_head + 1) % ALARM_RELAY_QUEUE_SIZE;
+	relay_count--;
+	// every queued alarm waits for its own jitter, so it does not go out right behind the previous one
+	if (relay_count > 0) {
+		ctimer_set(&relay_timer, random_rand() % ALARM_RELAY_JITTER, send_relayed, NULL);
+	}
+}
+
+/**
+ * Queue an alarm for a jittered re-broadcast, returns 0 if the queue is full
+*/
+static int queue_relay(const struct collect_msg *msg) {
+	if (relay_count == ALARM_RELAY_QUEUE_SIZE) {
+		return 0;
+	}
+	relay_queue[(relay_head + relay_count) % ALARM_RELAY_QUEUE_SIZE] = *msg;
+	relay_count++;
+	if (relay_count == 1) {
+		ctimer_set(&relay_timer, random_rand() % ALARM_RELAY_JITTER, send_relayed, NULL);
+	}
+	return 1;
+}
+
 static void
 recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from) {
 	struct collect_msg *msg;
 	msg = packetbuf_dataptr();
 
+	int subscribed = group_contains(&subscribed_groups, msg->group_id);
+	int relay = group_contains(&relay_groups, msg->group_id);
+	// drop alarms of other groups before doing any work for them
+	if ((!subscribed && !relay) || linkaddr_cmp(&msg->origin, &linkaddr_node_addr) || !alarm_is_new(msg)) {
+		return;
+	}
+
+	if (relay && msg->ttl > 0) {
+		msg->ttl--;
+		if (!queue_relay(msg)) {
+			printf("Alarm relay queue full, not relaying group %u\n", msg->group_id);
+		}
+	}
+	if (!subscribed) {
+		return;
+	}
+
 	printf("broadcast message received from %d.%d: %s %u %u\n", 
 		from->u8[0], from->u8[1], msg->identifier, msg->group_id, msg->alert);
+	// the cooja log time of this line minus the time of the matching "Alarm sent" line is the propagation latency
+	printf("Alarm received: seq %u from %d.%d at %lu ticks\n",
+		msg->seq_no, from->u8[0], from->u8[1], (unsigned long)clock_time());
 
 
 	if (msg->alert == 1) {
@@ -68,7 +205,16 @@ PROCESS_THREAD(pt_btn, ev, data) {
 	// inform neighbouring motes about the fire alert
 	static struct collect_msg msg;
 	msg.identifier = "AUA";
-	msg.group_id = 15;
+	msg.group_id = ALARM_SEND_GROUP;
+	msg.seq_no = 0;
+	linkaddr_copy(&msg.origin, &linkaddr_node_addr);
+
+	static const uint8_t subscribe_ids[] = {ALARM_SUBSCRIBED_GROUPS};
+	group_add_all(&subscribed_groups, subscribe_ids, sizeof(subscribe_ids));
+#ifdef ALARM_RELAY_GROUPS
+	static const uint8_t relay_ids[] = {ALARM_RELAY_GROUPS};
+	group_add_all(&relay_groups, relay_ids, sizeof(relay_ids));
+#endif
 
 	while (1)
 	{
@@ -79,12 +225,15 @@ PROCESS_THREAD(pt_btn, ev, data) {
 		{
 			leds_on(LEDS_RED);
 			msg.alert = 1;
+			msg.seq_no++;
+			msg.ttl = ALARM_MAX_HOPS;
 			/* Copy data to the packet buffer */
-			packetbuf_copyfrom(&msg, 5);
+			packetbuf_copyfrom(&msg, sizeof(struct collect_msg));
 			/* Send broadcast packet */
 			broadcast_send(&broadcast);
 			alarm = 1;
 			printf("Alarm triggered\n");
+			printf("Alarm sent: seq %u at %lu ticks\n", msg.seq_no, (unsigned long)clock_time());
 			// start another process to reset the alarm
 			process_start(&pt_listen, NULL);
 		} else {
@@ -96,9 +245,11 @@ PROCESS_THREAD(pt_btn, ev, data) {
 			}
 			leds_off(LEDS_ALL);
 			msg.alert = 0;
+			msg.seq_no++;
+			msg.ttl = ALARM_MAX_HOPS;
 			alarm = 0;
 			/* Copy data to the packet buffer */
-			packetbuf_copyfrom(&msg, 5);
+			packetbuf_copyfrom(&msg, sizeof(struct collect_msg));
 			/* Send broadcast packet */
 			broadcast_send(&broadcast);
 			printf("Alarm turned off\n");
@@ -124,3 +275,18 @@ PROCESS_THREAD(pt_listen, ev, data)
 	}
 	PROCESS_END();
 }
+
+/**
+ * Print the radio profile once, the shared energest report prints how long the cpu and the radio
+ * were on and the resulting average power. Run the same scenario with every radio profile
+ * (see project-conf.h) to compare idle power against the alarm latency printed by the sender and the receivers.
+*/
+PROCESS_THREAD(pt_energy, ev, data)
+{
+	PROCESS_BEGIN();
+
+	printf("Radio profile %u, channel check rate %u Hz\n", ALARM_RDC_PROFILE, ALARM_CHECK_RATE);
+	energest_report_start(CLOCK_SECOND * ALARM_ENERGY_INTERVAL);
+
+	PROCESS_END();
+}
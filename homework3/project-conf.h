@@ -0,0 +1,47 @@
+#ifndef PROJECT_CONF_H_
+#define PROJECT_CONF_H_
+
+/**
+ * Radio duty-cycling profiles for the alarm network.
+ * The profile is selected from the Makefile (make PROFILE=alwayson CHECK_RATE=8)
+ *  0 - always-on radio (nullrdc), the latency baseline
+ *  1 - ContikiMAC, broadcasts are repeated for a full wake-up interval (the strobe),
+ *      the default RDC layer of the sky platform and what onehop ran with originally
+ *  2 - X-MAC, short preamble strobes before every frame
+ */
+#ifndef ALARM_RDC_PROFILE
+#define ALARM_RDC_PROFILE 1
+#endif
+
+/* Channel check rate in Hz (must be a power of two), only used by the duty-cycled profiles */
+#ifndef ALARM_CHECK_RATE
+#define ALARM_CHECK_RATE 8
+#endif
+
+#undef NETSTACK_CONF_RDC
+#undef NETSTACK_CONF_MAC
+#undef NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE
+
+#if ALARM_RDC_PROFILE == 1
+#define NETSTACK_CONF_RDC contikimac_driver
+#elif ALARM_RDC_PROFILE == 2
+#define NETSTACK_CONF_RDC cxmac_driver
+#else
+#define NETSTACK_CONF_RDC nullrdc_driver
+#endif
+
+#define NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE ALARM_CHECK_RATE
+
+/**
+ * The alarm is the only traffic of this application, so frames are handed straight
+ * to the RDC layer instead of going through the CSMA packet queue and its backoff.
+ * The wake-up strobe of the RDC layer is what makes the neighbours hear it.
+ */
+#define NETSTACK_CONF_MAC nullmac_driver
+
+/* Print the energest report every ALARM_ENERGY_INTERVAL seconds */
+#ifndef ALARM_ENERGY_INTERVAL
+#define ALARM_ENERGY_INTERVAL 10
+#endif
+
+#endif /* PROJECT_CONF_H_ */
@@ -0,0 +1,109 @@
+/**
+ * \file
+ *         Discovery latency against radio duty cycle of Disco
+ *
+ *         All motes run the same phases, one for every pair of primes in
+ *         prime_pairs. A phase starts discovery with a cleared neighbour table
+ *         and prints every new neighbour with the time since the phase began:
+ *           DISCO found <addr> after <ms> ms rssi <rssi> lqi <lqi>
+ *         and at its end the neighbours found and the share of time the radio
+ *         was on (Energest listen + transmit):
+ *           DISCO phase <p1>,<p2> neighbours <n> mean <ms> max <ms> radio <percent>%
+ *         "DISCO done" follows the last phase. The motes of the simulation
+ *         boot together, so the phases of all motes line up.
+ */
+#include "contiki.h"
+#include "net/rime/rime.h"
+#include "sys/energest.h"
+#include "disco.h"
+#include <stdio.h>
+
+/* Length of a phase, long enough for the worst-case latency of the largest primes */
+#ifndef DISCO_PHASE_SECONDS
+#define DISCO_PHASE_SECONDS 90
+#endif
+
+/* Pause between two phases, so all beacons of the last one are gone */
+#define DISCO_PHASE_GAP 2
+
+/* Prime pairs of the phases, from a high to a low duty cycle */
+static const uint8_t prime_pairs[][2] = {
+    {5, 7},
+    {11, 13},
+    {23, 29},
+    {43, 47},
+};
+#define PHASES (sizeof(prime_pairs) / sizeof(prime_pairs[0]))
+
+/*---------------------------------------------------------------------------*/
+PROCESS(disco_benchmark_process, "Disco benchmark");
+AUTOSTART_PROCESSES(&disco_benchmark_process);
+
+static clock_time_t phase_start;
+/* latencies of the discoveries of this phase, a neighbour that was lost and found again counts twice */
+static uint8_t discoveries;
+static unsigned long latency_sum;
+static unsigned long latency_max;
+
+/*---------------------------------------------------------------------------*/
+static void
+neighbour_found(const struct disco_neighbour *n)
+{
+    unsigned long latency = (unsigned long)(n->first_seen - phase_start) * 1000 / CLOCK_SECOND;
+
+    discoveries++;
+    latency_sum += latency;
+    if(latency > latency_max) {
+        latency_max = latency;
+    }
+    printf("DISCO found %d.%d after %lu ms rssi %d lqi %u\n",
+           n->addr.u8[0], n->addr.u8[1], latency, n->rssi, n->lqi);
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(disco_benchmark_process, ev, data) {
+    static struct etimer et;
+    static uint8_t phase;
+    static unsigned long old_cpu, old_lpm, old_listen, old_transmit;
+
+    PROCESS_BEGIN();
+
+    for(phase = 0; phase < PHASES; phase++) {
+        discoveries = 0;
+        latency_sum = 0;
+        latency_max = 0;
+
+        energest_flush();
+        old_cpu = energest_type_time(ENERGEST_TYPE_CPU);
+        old_lpm = energest_type_time(ENERGEST_TYPE_LPM);
+        old_listen = energest_type_time(ENERGEST_TYPE_LISTEN);
+        old_transmit = energest_type_time(ENERGEST_TYPE_TRANSMIT);
+
+        phase_start = clock_time();
+        disco_start(prime_pairs[phase][0], prime_pairs[phase][1], neighbour_found);
+
+        etimer_set(&et, CLOCK_SECOND * DISCO_PHASE_SECONDS);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+        disco_stop();
+
+        energest_flush();
+        unsigned long total = energest_type_time(ENERGEST_TYPE_CPU) - old_cpu
+                              + energest_type_time(ENERGEST_TYPE_LPM) - old_lpm;
+        unsigned long radio = energest_type_time(ENERGEST_TYPE_LISTEN) - old_listen
+                              + energest_type_time(ENERGEST_TYPE_TRANSMIT) - old_transmit;
+        /* per mille of the phase the radio was on */
+        unsigned long radio_pm = total > 0 ? radio * 1000 / total : 0;
+
+        printf("DISCO phase %u,%u neighbours %u mean %lu max %lu radio %lu.%lu%%\n",
+               prime_pairs[phase][0], prime_pairs[phase][1], disco_neighbour_count(),
+               discoveries > 0 ? latency_sum / discoveries : 0, latency_max,
+               radio_pm / 10, radio_pm % 10);
+
+        etimer_set(&et, CLOCK_SECOND * DISCO_PHASE_GAP);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+    }
+
+    printf("DISCO done\n");
+
+    PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
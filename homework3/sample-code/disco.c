@@ -0,0 +1,249 @@
+/**
+ * \file
+ *         Duty-cycled asynchronous neighbour discovery (Disco), see disco.h
+ */
+#include "contiki.h"
+#include "net/rime/rime.h"
+#include "net/netstack.h"
+#include "lib/list.h"
+#include "lib/memb.h"
+#include "random.h"
+#include "disco.h"
+#include <stdio.h>
+
+/* Weight in percent of the old value when the RSSI and LQI of a new beacon are smoothed in */
+#define LINK_ALPHA 75
+
+/* Longest wait at the end of an active slot for the MAC layer to report the beacons as sent */
+#define BEACON_SENT_TIMEOUT (CLOCK_SECOND / 8)
+
+/* Beacon, the primes tell the receivers how often to expect it */
+struct disco_beacon {
+    uint8_t prime1;
+    uint8_t prime2;
+};
+
+/*---------------------------------------------------------------------------*/
+PROCESS(disco_process, "Neighbour discovery");
+
+LIST(neighbour_table);
+MEMB(neighbour_mem, struct disco_neighbour, DISCO_MAX_NEIGHBOURS);
+
+static struct broadcast_conn beacon_conn;
+static uint8_t prime1, prime2;
+static void (*found_callback)(const struct disco_neighbour *n);
+/* Number of the current slot */
+static uint32_t slot;
+/* Beacons handed to the MAC layer and not reported as sent yet, the radio is only turned off without any */
+static uint8_t beacons_pending;
+
+/*---------------------------------------------------------------------------*/
+struct disco_neighbour *
+disco_lookup(const linkaddr_t *addr)
+{
+    struct disco_neighbour *n;
+    for(n = list_head(neighbour_table); n != NULL; n = list_item_next(n)) {
+        if(linkaddr_cmp(&n->addr, addr)) {
+            return n;
+        }
+    }
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+struct disco_neighbour *
+disco_neighbours(void)
+{
+    return list_head(neighbour_table);
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+disco_neighbour_count(void)
+{
+    return list_length(neighbour_table);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Worst-case time between two discoveries of a neighbour with the primes p and q.
+ * A prime of this node and a different prime of the neighbour are active in the same slot once
+ * in their product, the bound is the smallest such product over the primes of both nodes.
+ * Two equal primes only meet if the slot numbers happen to line up, they give no bound.
+ */
+static clock_time_t
+discovery_bound(uint8_t p, uint8_t q)
+{
+    const uint8_t own[2] = {prime1, prime2};
+    const uint8_t other[2] = {p, q};
+    uint32_t bound = 0;
+    uint8_t i, j;
+    for(i = 0; i < 2; i++) {
+        for(j = 0; j < 2; j++) {
+            uint32_t product = (uint32_t)own[i] * other[j];
+            if(own[i] != other[j] && (bound == 0 || product < bound)) {
+                bound = product;
+            }
+        }
+    }
+    if(bound == 0) {
+        /* both nodes use a single and the same prime, fall back to its square */
+        bound = (uint32_t)prime1 * prime1;
+    }
+    return (clock_time_t)(bound * DISCO_SLOT);
+}
+/*---------------------------------------------------------------------------*/
+static void
+remove_stale_neighbours(void)
+{
+    struct disco_neighbour *n = list_head(neighbour_table);
+    while(n != NULL) {
+        struct disco_neighbour *next = list_item_next(n);
+        if((clock_time_t)(clock_time() - n->last_seen) >
+           DISCO_NEIGHBOUR_TIMEOUT * discovery_bound(n->prime1, n->prime2)) {
+            printf("DISCO lost %d.%d\n", n->addr.u8[0], n->addr.u8[1]);
+            list_remove(neighbour_table, n);
+            memb_free(&neighbour_mem, n);
+        }
+        n = next;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+beacon_recv(struct broadcast_conn *c, const linkaddr_t *from)
+{
+    struct disco_beacon beacon;
+    struct disco_neighbour *n;
+    int16_t rssi = (int16_t)packetbuf_attr(PACKETBUF_ATTR_RSSI);
+    uint8_t lqi = packetbuf_attr(PACKETBUF_ATTR_LINK_QUALITY);
+
+    if(packetbuf_datalen() < sizeof(beacon)) {
+        return;
+    }
+    memcpy(&beacon, packetbuf_dataptr(), sizeof(beacon));
+    if(beacon.prime1 == 0 || beacon.prime2 == 0) {
+        return;
+    }
+    n = disco_lookup(from);
+    if(n == NULL) {
+        n = memb_alloc(&neighbour_mem);
+        if(n == NULL) {
+            return;
+        }
+        linkaddr_copy(&n->addr, from);
+        n->prime1 = beacon.prime1;
+        n->prime2 = beacon.prime2;
+        n->rssi = rssi;
+        n->lqi = lqi;
+        n->beacons = 1;
+        n->first_seen = clock_time();
+        n->last_seen = n->first_seen;
+        list_add(neighbour_table, n);
+        if(found_callback != NULL) {
+            found_callback(n);
+        }
+        return;
+    }
+    n->prime1 = beacon.prime1;
+    n->prime2 = beacon.prime2;
+    n->rssi = (n->rssi * LINK_ALPHA + rssi * (100 - LINK_ALPHA)) / 100;
+    n->lqi = ((uint16_t)n->lqi * LINK_ALPHA + lqi * (100 - LINK_ALPHA)) / 100;
+    n->last_seen = clock_time();
+    n->beacons++;
+}
+
+static void
+beacon_sent_callback(struct broadcast_conn *c, int status, int num_tx)
+{
+    if(beacons_pending > 0) {
+        beacons_pending--;
+    }
+    process_poll(&disco_process);
+}
+
+static const struct broadcast_callbacks beacon_cb = {beacon_recv, beacon_sent_callback};
+/*---------------------------------------------------------------------------*/
+static void
+send_beacon(void)
+{
+    struct disco_beacon beacon;
+    beacon.prime1 = prime1;
+    beacon.prime2 = prime2;
+    packetbuf_copyfrom(&beacon, sizeof(beacon));
+    if(broadcast_send(&beacon_conn)) {
+        beacons_pending++;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Number of slots from the current one to the next active one
+ */
+static uint16_t
+slots_to_next_active(void)
+{
+    uint16_t d1 = prime1 - slot % prime1;
+    uint16_t d2 = prime2 - slot % prime2;
+    return d1 < d2 ? d1 : d2;
+}
+/*---------------------------------------------------------------------------*/
+void
+disco_start(uint8_t p1, uint8_t p2, void (*found)(const struct disco_neighbour *n))
+{
+    process_exit(&disco_process);
+    while(list_head(neighbour_table) != NULL) {
+        memb_free(&neighbour_mem, list_pop(neighbour_table));
+    }
+    prime1 = p1;
+    prime2 = p2;
+    found_callback = found;
+    process_start(&disco_process, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+disco_stop(void)
+{
+    process_exit(&disco_process);
+    NETSTACK_RADIO.on();
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(disco_process, ev, data)
+{
+    static struct etimer et;
+    static uint8_t opened = 0;
+
+    PROCESS_BEGIN();
+
+    if(!opened) {
+        list_init(neighbour_table);
+        memb_init(&neighbour_mem);
+        broadcast_open(&beacon_conn, DISCO_CHANNEL, &beacon_cb);
+        opened = 1;
+    }
+    /* nodes that start together must not have the same slot numbers */
+    slot = random_rand() % ((uint16_t)prime1 * prime2);
+    beacons_pending = 0;
+    NETSTACK_RADIO.off();
+
+    while(1) {
+        if(slot % prime1 != 0 && slot % prime2 != 0) {
+            uint16_t skip = slots_to_next_active();
+            etimer_set(&et, (clock_time_t)skip * DISCO_SLOT);
+            PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+            slot += skip;
+        }
+
+        /* active slot: listen for its whole length, with a beacon at both ends */
+        NETSTACK_RADIO.on();
+        send_beacon();
+        etimer_set(&et, DISCO_SLOT);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+        send_beacon();
+        /* the beacons may still wait in the CSMA queue, the radio stays on until both are out */
+        etimer_set(&et, BEACON_SENT_TIMEOUT);
+        PROCESS_WAIT_UNTIL(beacons_pending == 0 || etimer_expired(&et));
+        NETSTACK_RADIO.off();
+        slot++;
+
+        remove_stale_neighbours();
+    }
+
+    PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
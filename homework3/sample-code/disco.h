@@ -0,0 +1,78 @@
+/**
+ * \file
+ *         Duty-cycled asynchronous neighbour discovery (Disco)
+ *
+ *         Time is divided into slots. A node keeps its radio on only in the
+ *         slots whose number is a multiple of one of its two primes, and sends
+ *         a beacon at the start and at the end of every such slot. For a
+ *         prime p of one node and a different prime q of the other, both are
+ *         active in the same slot once every p * q slots (Chinese remainder
+ *         theorem), whatever the offset of their clocks, which bounds the
+ *         discovery latency. The radio is on in about 1/p1 + 1/p2 of the slots.
+ *
+ *         Other applications use it by adding this directory to PROJECTDIRS
+ *         and disco.c to PROJECT_SOURCEFILES. The radio must not be duty
+ *         cycled by the RDC layer as well (nullrdc).
+ */
+#ifndef DISCO_H_
+#define DISCO_H_
+
+#include "contiki.h"
+#include "net/linkaddr.h"
+
+/* Length of a slot, two clock ticks leave room for a beacon at both ends */
+#ifndef DISCO_SLOT
+#define DISCO_SLOT 2
+#endif
+
+/* Maximum number of neighbours in the table */
+#ifndef DISCO_MAX_NEIGHBOURS
+#define DISCO_MAX_NEIGHBOURS 16
+#endif
+
+/* Rime channel of the beacons */
+#ifndef DISCO_CHANNEL
+#define DISCO_CHANNEL 135
+#endif
+
+/* A neighbour is removed when it missed this many of its worst-case discovery intervals */
+#define DISCO_NEIGHBOUR_TIMEOUT 3
+
+struct disco_neighbour {
+    struct disco_neighbour *next;
+    linkaddr_t addr;
+    uint8_t prime1, prime2;  /* primes of the neighbour, its beacon rate follows from them */
+    int16_t rssi;            /* smoothed RSSI of its beacons */
+    uint8_t lqi;             /* smoothed LQI of its beacons */
+    uint16_t beacons;        /* number of beacons heard */
+    clock_time_t first_seen; /* clock time it was discovered */
+    clock_time_t last_seen;  /* clock time its last beacon arrived */
+};
+
+/**
+ * Start discovering with the given primes, the neighbour table is cleared.
+ * found is called for every newly discovered neighbour, it may be NULL.
+ */
+void disco_start(uint8_t prime1, uint8_t prime2, void (*found)(const struct disco_neighbour *n));
+
+/**
+ * Stop discovering, the radio is turned on again and the neighbour table is kept
+ */
+void disco_stop(void);
+
+/**
+ * First entry of the neighbour table, the next one is n->next
+ */
+struct disco_neighbour *disco_neighbours(void);
+
+/**
+ * The entry of a neighbour, or NULL if it was not discovered
+ */
+struct disco_neighbour *disco_lookup(const linkaddr_t *addr);
+
+/**
+ * Number of neighbours in the table
+ */
+uint8_t disco_neighbour_count(void);
+
+#endif /* DISCO_H_ */
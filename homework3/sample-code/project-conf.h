@@ -0,0 +1,11 @@
+#ifndef PROJECT_CONF_H_
+#define PROJECT_CONF_H_
+
+/**
+ * Disco turns the radio on and off by itself, a duty cycling RDC layer (ContikiMAC is the
+ * default of the sky platform) would turn it on again for its channel checks
+ */
+#undef NETSTACK_CONF_RDC
+#define NETSTACK_CONF_RDC nullrdc_driver
+
+#endif /* PROJECT_CONF_H_ */
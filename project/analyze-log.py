@@ -0,0 +1,405 @@
+#!/usr/bin/env python3
+"""
+Streaming analyzer for the Cooja logs of the AODV simulation.
+
+Reads the log in one pass and keeps only per-flow counters, a fixed-size latency histogram per flow
+and the packets still in flight, so its memory does not grow with the length of the log.
+
+Accepted log formats, one mote output line per log line:
+  - Log Listener "Save to file":   <time ms or mm:ss.mmm> TAB ID:<id> TAB <message>
+  - Simulation script output:      <time us>:<id>:<message>  or  <time us> ID:<id> <message>
+
+It uses the machine readable lines printed by aodv.c:
+  CTRL <type> ...               every routing message sent (rreq, rreq-fwd, rrep, rerr, beacon, gradient, hello)
+  DIAG <type> ...               messages sent only for the printouts of the application (path), not routing overhead
+  ROUTE dest <a.b> hops <n>     a RREP arrived at the node that started the discovery
+  Route discovery for <a.b> failed ...
+  TRAFFIC tx / TRAFFIC rx       packets of the traffic generator
+  ENERGY cpu .. listen ..       Energest report, the radio duty cycle over the whole run per node
+
+Usage:
+  ./analyze-log.py COOJA.testlog [--csc aodv.csc] [--json]
+  gzip -dc big.log.gz | ./analyze-log.py -
+
+With --csc the shortest hop count between two motes is computed from their positions and the
+transmitting range of the UDGM radio medium, and the path stretch of every flow is reported.
+"""
+
+import argparse
+import collections
+import gzip
+import json
+import math
+import re
+import sys
+import xml.etree.ElementTree as ElementTree
+
+LISTENER_LINE = re.compile(r'^\s*([\d:.]+)\s+ID:(\d+)\s+(.*)$')
+SCRIPT_LINE = re.compile(r'^(\d+):(\d+):(.*)$')
+
+CTRL = re.compile(r'^CTRL (\S+)')
+DIAG = re.compile(r'^DIAG (\S+)')
+ROUTE = re.compile(r'^ROUTE dest (\d+)\.\d+ hops (\d+)')
+DISCOVERY_FAILED = re.compile(r'^Route discovery for (\d+)\.\d+ failed')
+TRAFFIC_TX = re.compile(r'^TRAFFIC tx dest (\d+)\.\d+ seq (\d+) phase (\d+) sent \d+ hops (\d+) (ok|drop)')
+TRAFFIC_RX = re.compile(r'^TRAFFIC rx src (\d+)\.\d+ seq (\d+) phase (\d+)')
+ENERGY = re.compile(r'^ENERGY cpu (\d+) lpm (\d+) listen (\d+) transmit (\d+) .*power (\d+)')
+
+MEASURE_PHASE = 2
+
+# latency histogram buckets are powers of two of microseconds, up to about 70 minutes
+HISTOGRAM_BUCKETS = 32
+
+
+class Histogram:
+    """Latency distribution in power of two buckets, percentiles are exact to a factor of two"""
+
+    def __init__(self):
+        self.buckets = [0] * HISTOGRAM_BUCKETS
+        self.count = 0
+        self.total = 0
+        self.minimum = None
+        self.maximum = None
+
+    def add(self, value):
+        bucket = min(int(value).bit_length(), HISTOGRAM_BUCKETS - 1)
+        self.buckets[bucket] += 1
+        self.count += 1
+        self.total += value
+        self.minimum = value if self.minimum is None else min(self.minimum, value)
+        self.maximum = value if self.maximum is None else max(self.maximum, value)
+
+    def mean(self):
+        return self.total / self.count if self.count else None
+
+    def percentile(self, p):
+        """Upper bound of the bucket the p-th percentile falls into"""
+        if not self.count:
+            return None
+        rank = math.ceil(self.count * p / 100)
+        seen = 0
+        for bucket, n in enumerate(self.buckets):
+            seen += n
+            if seen >= rank:
+                return min(1 << bucket, self.maximum)
+        return self.maximum
+
+
+class Flow:
+    def __init__(self):
+        self.sent = 0
+        self.dropped_at_source = 0
+        self.delivered = 0
+        self.duplicates = 0
+        self.lost = 0
+        self.hops_total = 0
+        self.hops_count = 0
+        self.latency = Histogram()
+
+
+class Discovery:
+    def __init__(self):
+        self.started = 0
+        self.found = 0
+        self.failed = 0
+        self.hops_total = 0
+        self.latency = Histogram()
+
+
+class Analyzer:
+    def __init__(self, time_unit, timeout_us, max_pending, measure_only):
+        self.time_unit = time_unit
+        self.timeout_us = timeout_us
+        self.max_pending = max_pending
+        self.measure_only = measure_only
+        self.flows = collections.defaultdict(Flow)
+        self.discoveries = collections.defaultdict(Discovery)
+        # (source, destination) -> start time of the running discovery
+        self.open_discoveries = {}
+        # (source, destination, seq) -> send time, oldest first
+        self.in_flight = collections.OrderedDict()
+        self.control = collections.Counter()
+        self.control_per_node = collections.Counter()
+        self.diagnostic = collections.Counter()
+        # node -> [ms on, ms radio on, sum of the reported power, reports]
+        self.energy = collections.defaultdict(lambda: [0, 0, 0, 0])
+        self.lines = 0
+        self.unparsed = 0
+        self.last_time = 0
+
+    def parse_time(self, text, script):
+        """Log time in microseconds"""
+        if ':' in text:
+            minutes, seconds = text.rsplit(':', 1)
+            return int((int(minutes) * 60 + float(seconds)) * 1000000)
+        unit = self.time_unit or ('us' if script else 'ms')
+        value = float(text)
+        return int(value * 1000) if unit == 'ms' else int(value)
+
+    def feed(self, line):
+        self.lines += 1
+        match = SCRIPT_LINE.match(line)
+        script = match is not None
+        if not script:
+            match = LISTENER_LINE.match(line)
+            if match is None:
+                self.unparsed += 1
+                return
+        time = self.parse_time(match.group(1), script)
+        node = int(match.group(2))
+        message = match.group(3).strip()
+        self.last_time = time
+        self.expire(time)
+
+        m = CTRL.match(message)
+        if m:
+            self.control[m.group(1)] += 1
+            self.control_per_node[node] += 1
+            if m.group(1) == 'rreq':
+                dest = int(message.split('dest ')[1].split('.')[0])
+                key = (node, dest)
+                if key not in self.open_discoveries:
+                    self.open_discoveries[key] = time
+                    self.discoveries[key].started += 1
+            return
+        m = DIAG.match(message)
+        if m:
+            self.diagnostic[m.group(1)] += 1
+            return
+        m = ENERGY.match(message)
+        if m:
+            cpu, lpm, listen, transmit, power = (int(g) for g in m.groups())
+            e = self.energy[node]
+            e[0] += cpu + lpm
+            e[1] += listen + transmit
+            e[2] += power
+            e[3] += 1
+            return
+        m = ROUTE.match(message)
+        if m:
+            key = (node, int(m.group(1)))
+            start = self.open_discoveries.pop(key, None)
+            if start is not None:
+                d = self.discoveries[key]
+                d.found += 1
+                d.hops_total += int(m.group(2))
+                d.latency.add(time - start)
+            return
+        m = DISCOVERY_FAILED.match(message)
+        if m:
+            key = (node, int(m.group(1)))
+            if self.open_discoveries.pop(key, None) is not None:
+                self.discoveries[key].failed += 1
+            return
+        m = TRAFFIC_TX.match(message)
+        if m:
+            if self.measure_only and int(m.group(3)) != MEASURE_PHASE:
+                return
+            dest = int(m.group(1))
+            flow = self.flows[(node, dest)]
+            flow.sent += 1
+            if m.group(5) == 'drop':
+                flow.dropped_at_source += 1
+                return
+            hops = int(m.group(4))
+            if hops:
+                flow.hops_total += hops
+                flow.hops_count += 1
+            self.in_flight[(node, dest, int(m.group(2)))] = time
+            if len(self.in_flight) > self.max_pending:
+                self.lose(self.in_flight.popitem(last=False)[0])
+            return
+        m = TRAFFIC_RX.match(message)
+        if m:
+            if self.measure_only and int(m.group(3)) != MEASURE_PHASE:
+                return
+            source = int(m.group(1))
+            flow = self.flows[(source, node)]
+            sent = self.in_flight.pop((source, node, int(m.group(2))), None)
+            if sent is None:
+                # a second copy, or it arrived after the timeout and was counted as lost
+                flow.duplicates += 1
+                return
+            flow.delivered += 1
+            flow.latency.add(time - sent)
+
+    def lose(self, key):
+        self.flows[(key[0], key[1])].lost += 1
+
+    def expire(self, now):
+        while self.in_flight:
+            key, sent = next(iter(self.in_flight.items()))
+            if now - sent < self.timeout_us:
+                break
+            del self.in_flight[key]
+            self.lose(key)
+
+    def finish(self):
+        for key in list(self.in_flight):
+            self.lose(key)
+        self.in_flight.clear()
+        for key in self.open_discoveries:
+            self.discoveries[key].failed += 1
+        self.open_discoveries.clear()
+
+
+def read_topology(path):
+    """Shortest hop counts between all motes of a .csc file with the UDGM radio medium"""
+    root = ElementTree.parse(path).getroot()
+    tx_range = float(root.find('.//radiomedium/transmitting_range').text)
+    positions = {}
+    for mote in root.iter('mote'):
+        x = y = node = None
+        for config in mote.findall('interface_config'):
+            kind = (config.text or '').strip()
+            if kind.endswith('.Position'):
+                x = float(config.find('x').text)
+                y = float(config.find('y').text)
+            elif config.find('id') is not None:
+                node = int(config.find('id').text)
+        if node is not None and x is not None:
+            positions[node] = (x, y)
+    neighbours = {a: [b for b in positions if b != a and math.dist(positions[a], positions[b]) <= tx_range]
+                  for a in positions}
+    distances = {}
+    for source in positions:
+        distance = {source: 0}
+        queue = collections.deque([source])
+        while queue:
+            a = queue.popleft()
+            for b in neighbours[a]:
+                if b not in distance:
+                    distance[b] = distance[a] + 1
+                    queue.append(b)
+        for dest, hops in distance.items():
+            distances[(source, dest)] = hops
+    return distances
+
+
+def ms(us):
+    return None if us is None else round(us / 1000, 3)
+
+
+def report(analyzer, shortest):
+    flows = []
+    delivered = 0
+    for (source, dest), flow in sorted(analyzer.flows.items()):
+        delivered += flow.delivered
+        hops = flow.hops_total / flow.hops_count if flow.hops_count else None
+        optimal = shortest.get((source, dest)) if shortest else None
+        flows.append({
+            'source': source, 'dest': dest,
+            'sent': flow.sent, 'delivered': flow.delivered, 'lost': flow.lost,
+            'dropped_at_source': flow.dropped_at_source, 'duplicates': flow.duplicates,
+            'pdr': round(flow.delivered / flow.sent, 4) if flow.sent else None,
+            'latency_ms': {'mean': ms(flow.latency.mean()), 'min': ms(flow.latency.minimum),
+                           'p50': ms(flow.latency.percentile(50)), 'p95': ms(flow.latency.percentile(95)),
+                           'p99': ms(flow.latency.percentile(99)), 'max': ms(flow.latency.maximum)},
+            'hops': round(hops, 2) if hops else None,
+            'shortest_hops': optimal,
+            'path_stretch': round(hops / optimal, 3) if hops and optimal else None,
+        })
+    discoveries = []
+    for (source, dest), d in sorted(analyzer.discoveries.items()):
+        optimal = shortest.get((source, dest)) if shortest else None
+        hops = d.hops_total / d.found if d.found else None
+        discoveries.append({
+            'source': source, 'dest': dest, 'started': d.started, 'found': d.found, 'failed': d.failed,
+            'latency_ms': {'mean': ms(d.latency.mean()), 'p50': ms(d.latency.percentile(50)),
+                           'max': ms(d.latency.maximum)},
+            'hops': round(hops, 2) if hops else None,
+            'path_stretch': round(hops / optimal, 3) if hops and optimal else None,
+        })
+    control_total = sum(analyzer.control.values())
+    on_total = sum(e[0] for e in analyzer.energy.values())
+    radio_total = sum(e[1] for e in analyzer.energy.values())
+    return {
+        'lines': analyzer.lines, 'unparsed_lines': analyzer.unparsed,
+        'simulated_s': round(analyzer.last_time / 1000000, 3),
+        'flows': flows,
+        'discoveries': discoveries,
+        'control': {
+            'total': control_total,
+            'by_type': dict(analyzer.control),
+            'by_node': {str(k): v for k, v in sorted(analyzer.control_per_node.items())},
+            'per_delivered_packet': round(control_total / delivered, 3) if delivered else None,
+        },
+        'diagnostic': dict(analyzer.diagnostic),
+        'energy': {
+            'radio_duty_cycle_percent': round(100 * radio_total / on_total, 3) if on_total else None,
+            'power_uw_mean': round(sum(e[2] for e in analyzer.energy.values()) / sum(e[3] for e in analyzer.energy.values()), 1)
+                             if analyzer.energy else None,
+            'by_node': {str(k): round(100 * e[1] / e[0], 3) if e[0] else None for k, e in sorted(analyzer.energy.items())},
+        },
+    }
+
+
+def print_text(result):
+    print('%d lines, %d unparsed, %.1f s simulated' % (result['lines'], result['unparsed_lines'], result['simulated_s']))
+    print()
+    print('flow      sent  deliv  lost  drop   pdr   mean ms   p50 ms   p95 ms   p99 ms  hops  stretch')
+    for f in result['flows']:
+        l = f['latency_ms']
+        print('%3d->%-3d %5d  %5d %5d %5d  %s %s %s %s %s %5s  %7s' % (
+            f['source'], f['dest'], f['sent'], f['delivered'], f['lost'], f['dropped_at_source'],
+            fmt(f['pdr'], 5), fmt(l['mean'], 9), fmt(l['p50'], 8), fmt(l['p95'], 8), fmt(l['p99'], 8),
+            f['hops'] if f['hops'] is not None else '-', f['path_stretch'] if f['path_stretch'] is not None else '-'))
+    print()
+    print('discovery  started  found  failed   mean ms    max ms  hops  stretch')
+    for d in result['discoveries']:
+        l = d['latency_ms']
+        print('%3d->%-3d  %7d  %5d  %6d %s %s %5s  %7s' % (
+            d['source'], d['dest'], d['started'], d['found'], d['failed'], fmt(l['mean'], 9), fmt(l['max'], 9),
+            d['hops'] if d['hops'] is not None else '-', d['path_stretch'] if d['path_stretch'] is not None else '-'))
+    print()
+    c = result['control']
+    print('control messages: %d (%s), %s per delivered packet' % (
+        c['total'], ', '.join('%s %d' % kv for kv in sorted(c['by_type'].items())), c['per_delivered_packet']))
+    if result['diagnostic']:
+        print('diagnostic messages, not counted above: %s' % ', '.join('%s %d' % kv for kv in sorted(result['diagnostic'].items())))
+    e = result['energy']
+    if e['radio_duty_cycle_percent'] is not None:
+        print('radio duty cycle: %.3f%% over all nodes, mean power %.1f uW' % (e['radio_duty_cycle_percent'], e['power_uw_mean']))
+
+
+def fmt(value, width):
+    return ('%*.3f' % (width, value)) if isinstance(value, float) else ('%*s' % (width, '-' if value is None else value))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='One pass, constant memory analysis of AODV simulation logs')
+    parser.add_argument('log', help='log file, .gz is decompressed, - reads stdin')
+    parser.add_argument('--csc', help='simulation file, to compute the path stretch')
+    parser.add_argument('--time-unit', choices=['us', 'ms'],
+                        help='unit of plain numeric log times (default: ms for Log Listener files, us for script output)')
+    parser.add_argument('--timeout', type=float, default=60,
+                        help='seconds after which a packet that did not arrive is lost (default 60)')
+    parser.add_argument('--max-pending', type=int, default=100000,
+                        help='most packets kept in flight, the oldest is counted as lost beyond it (default 100000)')
+    parser.add_argument('--all-phases', action='store_true', help='include the warm-up traffic')
+    parser.add_argument('--json', action='store_true', help='print the result as JSON')
+    args = parser.parse_args()
+
+    analyzer = Analyzer(args.time_unit, int(args.timeout * 1000000), args.max_pending, not args.all_phases)
+    if args.log == '-':
+        log = sys.stdin
+    elif args.log.endswith('.gz'):
+        log = gzip.open(args.log, 'rt', errors='replace')
+    else:
+        log = open(args.log, errors='replace')
+    with log:
+        for line in log:
+            analyzer.feed(line)
+    analyzer.finish()
+
+    shortest = read_topology(args.csc) if args.csc else None
+    result = report(analyzer, shortest)
+    if args.json:
+        json.dump(result, sys.stdout, indent=2)
+        print()
+    else:
+        print_text(result)
+
+
+if __name__ == '__main__':
+    main()
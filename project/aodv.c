@@ -3,17 +3,38 @@
 #include "random.h"
 #include "dev/button-sensor.h"
 #include "dev/leds.h"
+#include "dev/serial-line.h"
+#include "dev/light-sensor.h"
+#include "dev/sht11/sht11-sensor.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include "lib/list.h"
 #include "lib/memb.h"
 
+#include "net/ip/uip.h"
+#include "net/ip/tcpip.h"
+#include "net/ipv4/uip-fw.h"
+#include "net/queuebuf.h"
+
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee.h"
+
+#include "energest-report.h"
+
 #include <stdbool.h>
 
 PROCESS(pt_source, "Message source");
 PROCESS(pt_timer, "Timer process");
 PROCESS(pt_delete_reverse_pointer, "Reverse pointer deletion process");
+PROCESS(pt_snapshot, "Routing table snapshot process");
+PROCESS(pt_traffic, "Traffic generator process");
+PROCESS(pt_energy, "Radio profile report");
+PROCESS(pt_timesync, "Time synchronization process");
+PROCESS(pt_gradient, "Collection gradient process");
+PROCESS(pt_sense, "Sensor sampling process");
+PROCESS(pt_cluster, "Cluster election process");
 
 AUTOSTART_PROCESSES(&pt_source);
 
@@ -21,6 +42,223 @@ AUTOSTART_PROCESSES(&pt_source);
 // Maximum number of enteries in routing table
 #define TABLE_SIZE 32
 
+// Maximum number of alternate next hops kept per destination besides the primary one
+#define MAX_ALTERNATES 2
+
+/** Maximum number of precursors (neighbours that forward through this node) kept per destination */
+#define MAX_PRECURSORS 3
+/** Maximum number of unreachable destinations listed in one RERR */
+#define RERR_MAX_DESTINATIONS 8
+
+// Maximum number of neighbours for which a link estimate is kept
+#define NEIGHBOUR_TABLE_SIZE 16
+
+/** Seconds the RREQs of a neighbour are ignored after a RREP to it failed */
+#define BLACKLIST_TIMEOUT 10
+
+/** Link costs are ETX values in fixed point, ETX_SCALE is an ETX of 1 (one transmission per delivery) */
+#define ETX_SCALE 16
+#define ETX_MAX (8 * ETX_SCALE)
+/** Weight in percent of the old estimate when a new ETX sample is smoothed in */
+#define ETX_ALPHA 70
+/** LQI range of the cc2420, at or below LQI_MIN a link is considered unusable, at LQI_MAX it is perfect */
+#define LQI_MIN 50
+#define LQI_MAX 106
+/** Below this RSSI (cc2420 register value) a link is close to the sensitivity limit and gets a penalty */
+#define RSSI_WEAK -30
+
+/** Maximum number of hops a RREQ travels (time to live of a route discovery) */
+#define NET_DIAMETER 35
+/** A node repairs a broken route itself if the destination was at most this many hops away */
+#define MAX_REPAIR_DISTANCE 4
+/** The local repair RREQ may travel this many hops more than the old distance to destination */
+#define LOCAL_ADD_TTL 2
+/** The number of seconds to wait for the RREP of a local repair before sending RERR */
+#define LOCAL_REPAIR_TIMEOUT 2
+
+/** Number of times a route discovery is retried before the destination is considered unreachable */
+#define RREQ_RETRIES 2
+/** Seconds to wait for the RREP of the first RREQ, doubled for every retry (binary exponential backoff) */
+#define DISCOVERY_TIMEOUT 2
+/** Maximum number of RREQs this node originates per second */
+#define RREQ_RATELIMIT 10
+/** Maximum number of route discoveries running at the same time */
+#define MAX_DISCOVERIES 4
+
+#if AODV_LOW_POWER
+/** Time between two channel checks of a neighbour, the longest a frame may wait for it to wake up */
+#define WAKEUP_INTERVAL (CLOCK_SECOND / AODV_CHECK_RATE)
+#else
+#define WAKEUP_INTERVAL 0
+#endif
+/** A forwarded RREQ is delayed by a random time up to this, so neighbours do not strobe it at the same time */
+#define RREQ_JITTER WAKEUP_INTERVAL
+
+/** Maximum payload of a reliable data frame in bytes */
+#define DATA_PAYLOAD_SIZE 32
+/** Maximum number of data frames waiting for transmission or acknowledgment */
+#define DATA_QUEUE_SIZE 6
+/** Maximum number of unacknowledged data frames per next hop */
+#define DATA_WINDOW_SIZE 3
+/** Time to wait for the acknowledgment of a data frame before retransmitting it, the frame and the
+ * acknowledgment may both wait a wake-up interval for their receiver */
+#define DATA_RTX_TIMEOUT (CLOCK_SECOND / 4 + 2 * WAKEUP_INTERVAL)
+/** Number of retransmissions before the link to the next hop is considered broken */
+#define DATA_MAX_RETRANSMISSIONS 4
+/** Number of (previous hop, hop sequence number) pairs remembered to detect retransmitted frames */
+#define DATA_SEEN_SIZE 8
+/** Number of destinations a local repair can run for at the same time on behalf of queued data frames */
+#define DATA_REPAIRS 2
+/**
+ * Aggregation (make AGGREGATE=1): messages up to AGGREGATE_MAX_LEN bytes are batched with others for the
+ * same next hop and wait up to AGGREGATION_DELAY at every hop. Off by default, so the latencies of the
+ * traffic generator do not include the wait, compare both with collect-benchmark.py --compare aggregation.
+*/
+#ifndef AODV_AGGREGATE
+#define AODV_AGGREGATE 0
+#endif
+/** Messages up to this length are batched with others for the same next hop */
+#define AGGREGATE_MAX_LEN 8
+/** Maximum time a message waits in an aggregation buffer */
+#define AGGREGATION_DELAY (CLOCK_SECOND / 2)
+/** Number of next hops messages can be batched for at the same time */
+#define AGGREGATE_BUFFERS 3
+/** Number of reliable data frames sent on a button press when the route is known */
+#define DATA_BURST_SIZE 4
+
+/** Number of IP packets buffered while the route to their destination is discovered */
+#define IP_QUEUE_SIZE 3
+
+/** Node id (first byte of the address) of the time reference, its clock is the global time */
+#ifndef TIMESYNC_ROOT
+#define TIMESYNC_ROOT 1
+#endif
+/** Seconds between two time beacons, skipped if a RREQ carried the time in the meantime */
+#define TIMESYNC_INTERVAL 10
+/** A node that heard nothing from its time parent for this many intervals is no longer synchronized */
+#define TIMESYNC_TIMEOUT 3
+/** Largest clock skew to the time parent that is compensated, in parts per million */
+#define TIMESYNC_MAX_SKEW 1000
+/** Sync level of a node without global time */
+#define TIMESYNC_UNSYNCED UINT8_MAX
+/**
+ * Worst-case error one hop of the synchronization adds to the global time, in rtimer ticks. Timestamps are
+ * taken in software when a frame is queued and when it is handed to this node, not at the SFD of the radio.
+ * In between the sender may back off once in CSMA (a channel check interval) and, with ContikiMAC, repeats
+ * a broadcast for a full wake-up interval of which the receiver hears any copy. Repeated collisions can
+ * exceed it. The printed latencies come with this bound summed over the sync levels of both ends, the
+ * latencies analyze-log.py computes from the Cooja log times do not depend on it.
+ */
+#define TIMESYNC_HOP_ERROR ((uint32_t)RTIMER_SECOND / AODV_CHECK_RATE * (AODV_LOW_POWER ? 2 : 1))
+/** Sync levels above this are reported as this level in the traffic packets */
+#define TIMESYNC_TRAFFIC_MAX_LEVEL 15
+
+/** Traffic generator modes, constant bit rate or Poisson arrivals with the same mean interval */
+#define TRAFFIC_OFF 0
+#define TRAFFIC_CBR 1
+#define TRAFFIC_POISSON 2
+#ifndef TRAFFIC_MODE
+#define TRAFFIC_MODE TRAFFIC_CBR
+#endif
+/** Mean time between two generated packets in milliseconds */
+#ifndef TRAFFIC_INTERVAL
+#define TRAFFIC_INTERVAL 1000
+#endif
+/** Node ids (first byte of the address) that start generating traffic at boot, 0 is no node */
+#ifndef TRAFFIC_SOURCES
+#define TRAFFIC_SOURCES 0
+#endif
+/** Node ids traffic is sent to, one picked at random per packet, 0 picks a random peer instead */
+#ifndef TRAFFIC_DESTINATIONS
+#define TRAFFIC_DESTINATIONS 8
+#endif
+/** Number of nodes random peers are picked from, their ids are 1 to TRAFFIC_NODES */
+#ifndef TRAFFIC_NODES
+#define TRAFFIC_NODES 10
+#endif
+/** Seconds of warm-up traffic, its packets are marked and left out of the measurement */
+#ifndef TRAFFIC_WARMUP
+#define TRAFFIC_WARMUP 30
+#endif
+/** Seconds of measured traffic, 0 is until stopped */
+#ifndef TRAFFIC_DURATION
+#define TRAFFIC_DURATION 300
+#endif
+/** Maximum number of traffic destinations */
+#define TRAFFIC_MAX_DESTINATIONS 8
+
+/** Names of the two Coffee files the routing table snapshots are written to in turn */
+#define SNAPSHOT_FILE_A "aodv_routes_a"
+#define SNAPSHOT_FILE_B "aodv_routes_b"
+/** Format version of the snapshot file, a snapshot of another version is ignored */
+#define SNAPSHOT_VERSION 2
+/** Seconds between two checks whether the routing table changed and must be written to flash */
+#define SNAPSHOT_INTERVAL 60
+/** Seconds a restored route is used before it must have been confirmed by new routing traffic */
+#define RESTORED_ROUTE_LIFETIME 20
+/** Broadcast ids skipped on restart, twice the RREQs that may be sent between two snapshots */
+#define BROADCAST_ID_RESERVE (2 * RREQ_RATELIMIT * SNAPSHOT_INTERVAL)
+
+/** Node id of the sink, the destination of the button press and, in collection mode, of all traffic */
+#ifndef SINK_ID
+#define SINK_ID 8
+#endif
+/**
+ * Collection mode (make COLLECT=1): the sink floods a gradient every GRADIENT_INTERVAL seconds and
+ * every node keeps the cheapest neighbour towards it as the route to the sink, so sink-bound data
+ * needs no route discovery. Routes to other destinations are still discovered on demand.
+*/
+#ifndef AODV_COLLECT
+#define AODV_COLLECT 0
+#endif
+/** Seconds between two gradient rounds of the sink */
+#define GRADIENT_INTERVAL 20
+/** A node passes a new gradient round on after a random delay up to this, cheaper parents heard meanwhile are used */
+#define GRADIENT_DELAY (CLOCK_SECOND / 2)
+
+/**
+ * Sensor sampling (make SENSING=1), the light and temperature sensors are read together every SENSE_INTERVAL seconds
+ *  0 - no sampling
+ *  1 - every node summarizes its readings per window (min, max, mean, count) and the summaries of a
+ *      window are merged at every hop towards the sink, one frame per node and window
+ *  2 - every batch of readings is sent to the sink as it is in a frame of its own, to compare against
+*/
+#ifndef AODV_SENSING
+#define AODV_SENSING 0
+#endif
+/** Seconds between two batches of sensor readings */
+#define SENSE_INTERVAL 5
+/** Seconds of readings in one summary, the windows start at multiples of it in global time */
+#define SENSE_WINDOW 60
+/** After the end of a window a node waits SENSE_HOP_DELAY for every hop it is closer to the sink than SENSE_MAX_HOPS, so its subtree reports first */
+#define SENSE_HOP_DELAY (CLOCK_SECOND / 2)
+#define SENSE_MAX_HOPS 10
+
+/**
+ * Clustered mode (make CLUSTER=1): nodes elect cluster heads by residual energy and degree, every
+ * other node joins a neighbouring head. Only heads and gateways (members that hear another cluster)
+ * relay RREQs, and a head stops the flood when the destination is one of its members, so the
+ * flood scope and the reverse routes it leaves follow the backbone instead of the whole network.
+*/
+#ifndef AODV_CLUSTER
+#define AODV_CLUSTER 0
+#endif
+/** Seconds between two hellos of a node */
+#define CLUSTER_INTERVAL 10
+/** Seconds of an election round, the heads are elected again in every round so the role rotates */
+#define CLUSTER_ROUND 120
+/** A neighbour whose hello was not heard for this many intervals does not count any more */
+#define CLUSTER_TIMEOUT 3
+/** Seconds of radio-on time the battery lasts, the residual energy is the share of it left */
+#define CLUSTER_ENERGY_BUDGET 3600
+/** Weight of one percent of residual energy against one neighbour in the election score */
+#define CLUSTER_ENERGY_WEIGHT 4
+/** Maximum number of members a head lists in its hello, the gateways of the cluster learn them from it */
+#define CLUSTER_HELLO_MEMBERS 8
+
+/** Sequence number value meaning the packet carried no sequence number for the destination */
+#define SEQ_UNKNOWN 0
+
 /** The number of seconds to wait for RREP before deleting the reverse pointer entries from routing table **/
 /** Please set this to number of seconds based on the numnber of nodes/network size */
 /** If number of nodes are increased for testing, increase it accordingly */
@@ -32,6 +270,26 @@ static struct broadcast_conn broadcast;
 // for unicast connection
 static struct unicast_conn uc;
 
+// for the RREPs, a connection of their own so that every send result reported on it belongs to a RREP
+static struct unicast_conn rrep_uc;
+
+// for reliable data connection
+static struct unicast_conn data_uc;
+
+// for IP packets routed over AODV
+static struct unicast_conn ip_uc;
+static struct broadcast_conn ip_bc;
+
+// for the gradient beacons of the collection tree
+static struct broadcast_conn gradient_bc;
+
+// for the RERRs, unicast to a single precursor or broadcast to several
+static struct unicast_conn rerr_uc;
+static struct broadcast_conn rerr_bc;
+
+// for the hellos of the cluster election
+static struct broadcast_conn cluster_bc;
+
 // counter for sequence number
 static uint32_t seq_no = 1;
 // counter for broadcast id
@@ -39,6 +297,14 @@ static uint32_t broadcast_id = 1;
 
 static struct etimer et1, et2;
 
+// a struct representing another next hop towards a destination
+struct alternate_route
+{
+    linkaddr_t next_addr; // address of the next node
+    uint8_t distance;     // distance to destination node over this next node (hop count)
+    uint16_t cost;        // sum of link ETX values to destination node over this next node
+};
+
 // a struct representing a single record/row for routing table
 struct table_record
 {
@@ -48,6 +314,42 @@ struct table_record
     uint8_t distance;      // distance to destination node (hop count)
     uint32_t dest_seq;     // sequence number for destination node
     uint32_t broadcast_id; // the unique brodcast id for the message
+    uint16_t cost;         // sum of link ETX values to destination node
+    struct alternate_route alternates[MAX_ALTERNATES]; // other loop-free next hops to destination node
+    uint8_t alternate_count; // number of valid entries in alternates
+    bool restored;           // loaded from the snapshot and not yet confirmed by routing traffic
+    linkaddr_t precursors[MAX_PRECURSORS]; // neighbours that forward to destination node through this node
+    uint8_t precursor_count; // number of valid entries in precursors, an invalid route with precursors still has to be reported
+};
+
+// a struct representing the link estimate to a neighbour
+struct neighbour_record
+{
+    struct neighbour_record *next;
+    linkaddr_t addr; // address of the neighbour
+    uint16_t etx;    // smoothed ETX of the link towards the neighbour (ETX_SCALE is 1)
+    bool blacklisted;      // a RREP to this neighbour failed, its RREQs are ignored
+    struct timer blacklist; // expires when the neighbour may be used again
+    uint8_t cluster_role;       // role announced in the last hello, CLUSTER_NONE if no hello was heard
+    uint8_t cluster_round;      // election round of the last hello, the role is only valid in that round
+    linkaddr_t cluster_head;    // head of the cluster of the neighbour
+    uint16_t cluster_score;     // election score of the neighbour
+    clock_time_t cluster_heard; // clock time the last hello was heard
+};
+
+#define CLUSTER_NONE 0   // no cluster yet, the node relays RREQs like without clustering
+#define CLUSTER_HEAD 1
+#define CLUSTER_MEMBER 2
+
+// a struct representing a hello of the cluster election
+struct cluster_hello
+{
+    uint8_t role;      // CLUSTER_NONE, CLUSTER_HEAD or CLUSTER_MEMBER
+    uint8_t round;     // election round, the low byte of the global time divided by the round length
+    linkaddr_t head;   // head of the cluster of the sender
+    uint16_t score;    // election score of the sender, see cluster_score()
+    uint8_t member_count; // number of valid entries in members, only heads list their members
+    linkaddr_t members[CLUSTER_HELLO_MEMBERS];
 };
 
 // a struct representing a message that is sent from source to destination
@@ -59,351 +361,2907 @@ struct route_msg
     uint32_t dest_seq;      // sequence number of destination node
     linkaddr_t dest_addr;   // address of the destination node
     uint8_t distance;       // distance travelled so far (hope count)
+    uint8_t ttl;            // number of hops a RREQ may still travel
+    uint16_t cost;          // link cost accumulated so far (ETX)
     bool is_print_only; // when this is true, just print the route/path to destination
+    uint32_t origin_time;   // global time the RREQ or RREP was sent by the node that created it
+    uint8_t origin_level;   // sync level of the node that created it, bounds the error of origin_time
+    uint8_t sync_level;     // hops of the sender to the time root, piggybacked on broadcasts
+    uint32_t sync_time;     // global time of the sender when it sent the broadcast
+};
+
+// an unreachable destination in a RERR
+struct rerr_destination
+{
+    linkaddr_t dest_addr; // address of the destination node
+    uint32_t dest_seq;    // last known sequence number of destination node
+};
+
+// a struct representing a RERR, only the first count destinations are sent
+struct rerr_msg
+{
+    uint8_t count;
+    struct rerr_destination unreachable[RERR_MAX_DESTINATIONS];
 };
 
+// size of a RERR with the given number of destinations
+#define RERR_SIZE(count) (offsetof(struct rerr_msg, unreachable) + (count) * sizeof(struct rerr_destination))
+
 // declare a list representing the routing table
 LIST(routing_table);
 MEMB(routing_table_mem, struct table_record, TABLE_SIZE);
 
+#define DATA_TYPE_DATA 0
+#define DATA_TYPE_ACK 1
+#define DATA_TYPE_AGGREGATE 2
+#define DATA_TYPE_SUMMARY 3
+
+// size of the header in front of every message in an aggregated frame: source, destination and length
+#define AGGREGATE_RECORD_HEADER (2 * sizeof(linkaddr_t) + 1)
+
+// a struct representing the small messages batched for one next hop
+struct aggregate_buffer
+{
+    struct aggregate_buffer *next;
+    linkaddr_t next_addr; // next hop all batched messages go to
+    uint8_t len;          // number of bytes used in data
+    uint8_t count;        // number of messages in data
+    struct ctimer timer;  // sends the batch when the aggregation delay is over
+    uint8_t data[DATA_PAYLOAD_SIZE];
+};
+
+// declare a list for the aggregation buffers
+LIST(aggregate_list);
+MEMB(aggregate_mem, struct aggregate_buffer, AGGREGATE_BUFFERS);
+
+// a struct representing an IP packet waiting for a route to its destination
+struct ip_packet
+{
+    struct ip_packet *next;
+    linkaddr_t dest_addr;  // node the packet is addressed to
+    struct queuebuf *buf;  // the packet as it was in packetbuf
+};
+
+// declare a list for the IP packets waiting for a route
+LIST(ip_queue);
+MEMB(ip_queue_mem, struct ip_packet, IP_QUEUE_SIZE);
+
+// a struct representing a data frame, or its acknowledgment, on the reliable data connection
+struct data_msg
+{
+    uint8_t type;           // DATA_TYPE_DATA or DATA_TYPE_ACK
+    uint8_t hop_seq;        // sequence number of the frame on the current hop, echoed in its acknowledgment
+    linkaddr_t source_addr; // address of the node that sent the data
+    linkaddr_t dest_addr;   // address of the destination node
+    uint8_t hops;           // number of hops travelled so far
+    uint16_t cost;          // link cost accumulated so far (ETX)
+    uint8_t len;            // number of valid bytes in payload
+    uint8_t payload[DATA_PAYLOAD_SIZE];
+};
+
+// size of a data frame without its payload
+#define DATA_HEADER_SIZE offsetof(struct data_msg, payload)
+
+// a struct representing a data frame waiting for transmission or acknowledgment
+struct data_frame
+{
+    struct data_frame *next;
+    linkaddr_t next_addr; // next hop the frame is sent to
+    uint8_t retries;      // number of retransmissions so far
+    bool in_flight;       // sent and waiting for its acknowledgment
+    bool repairing;       // held back while a local repair searches a new route to its destination
+    struct ctimer timer;  // retransmission timer
+    struct data_msg msg;
+};
+
+// declare a list for the data frames queued on this node
+LIST(data_queue);
+MEMB(data_queue_mem, struct data_frame, DATA_QUEUE_SIZE);
+
+// a struct representing a local repair started because queued data frames lost their next hop
+struct data_repair
+{
+    struct data_repair *next;
+    linkaddr_t dest_addr;  // destination a new route is searched for
+    struct ctimer timer;   // expires when the RREP of the repair did not arrive in time
+    linkaddr_t precursors[MAX_PRECURSORS]; // precursors of the route, only told about it if the repair fails
+    uint8_t precursor_count;
+};
+
+// declare a list for the local repairs of the data path
+LIST(data_repair_list);
+MEMB(data_repair_mem, struct data_repair, DATA_REPAIRS);
+
+// hop sequence number of the next data frame sent by this node
+static uint8_t data_hop_seq = 0;
+
+// the last data frames received, to acknowledge retransmissions without delivering them twice
+static struct {
+    linkaddr_t from;
+    uint8_t hop_seq;
+} data_seen[DATA_SEEN_SIZE];
+static uint8_t data_seen_next = 0;
+
+#define TRAFFIC_MAGIC 0xa5
+#define TRAFFIC_PHASE_IDLE 0
+#define TRAFFIC_PHASE_WARMUP 1
+#define TRAFFIC_PHASE_MEASURE 2
+
+// payload of a packet of the traffic generator
+struct traffic_msg
+{
+    uint8_t magic;      // TRAFFIC_MAGIC, tells traffic apart from other data
+    uint8_t phase : 4;  // TRAFFIC_PHASE_WARMUP or TRAFFIC_PHASE_MEASURE
+    uint8_t level : 4;  // sync level of the source up to TIMESYNC_TRAFFIC_MAX_LEVEL, bounds the error of timestamp
+    uint16_t seq;       // sequence number per source, gaps are lost packets
+    uint32_t timestamp; // global time of the source when the packet was generated
+};
+
+// a struct representing a gradient beacon of the collection tree
+struct gradient_beacon
+{
+    uint32_t seq;   // sequence number of the sink, every round uses a new one
+    uint8_t hops;   // hops of the sender to the sink
+    uint16_t cost;  // link cost of the sender to the sink (ETX)
+};
+
+#define SENSOR_LIGHT 0
+#define SENSOR_TEMPERATURE 1
+#define SENSOR_TYPES 2
+#define SENSE_MAGIC 0x5e
+
+// summary of the readings of one sensor
+struct sensor_stats
+{
+    int16_t min;
+    int16_t max;
+    int32_t sum;    // the mean is sum / count
+    uint16_t count; // number of readings
+};
+
+// summary of the readings of a subtree in one window, payload of a DATA_TYPE_SUMMARY frame
+struct sensor_summary
+{
+    uint32_t window; // global time of the window start divided by the window length
+    uint16_t nodes;  // number of nodes whose readings are in the summary
+    struct sensor_stats stats[SENSOR_TYPES];
+};
+
+// a summary collected on this node, every window still open has one
+struct summary_slot
+{
+    bool open;           // readings and summaries of the window are merged in, it was not sent yet
+    bool sampled;        // this node added its own readings
+    struct ctimer timer; // sends the summary once the subtree had time to report
+    struct sensor_summary summary;
+};
+
+// the current window and the previous one, which waits for the summaries of the subtree
+static struct summary_slot summary_slots[2];
+
+// payload of a batch of readings sent as it is (SENSING=2)
+struct sensor_reading
+{
+    uint8_t magic; // SENSE_MAGIC, tells readings apart from other data
+    int16_t values[SENSOR_TYPES];
+};
+
+// a struct representing a route discovery started by this node
+struct discovery_record
+{
+    struct discovery_record *next;
+    struct route_msg rreq; // the RREQ, sent again with a new broadcast id on every retry
+    uint8_t retries;       // number of retries done so far
+    struct ctimer timer;   // expires when the RREP did not arrive in time
+    uint32_t start_time;   // global time the discovery was started
+};
+
+// declare a list for the route discoveries in progress
+LIST(discovery_list);
+MEMB(discovery_mem, struct discovery_record, MAX_DISCOVERIES);
+
+// start of the current one second window for the RREQ rate limit and the RREQs sent in it
+static clock_time_t rreq_window_start;
+static uint8_t rreq_window_count;
+
+// declare a list for the link estimates of the neighbours
+LIST(neighbour_table);
+MEMB(neighbour_table_mem, struct neighbour_record, NEIGHBOUR_TABLE_SIZE);
+
+// for the time beacons
+static struct broadcast_conn timesync_bc;
+
+// a struct representing a time beacon
+struct timesync_beacon
+{
+    uint8_t level; // hops of the sender to the time root
+    uint32_t time; // global time of the sender when it sent the beacon
+};
+
+// hops to the time root, the root has level 0
+static uint8_t timesync_level = TIMESYNC_UNSYNCED;
+// the neighbour the global time is taken from
+static linkaddr_t timesync_parent;
+// local and global time at the last synchronization, the global time is extrapolated from them
+static uint32_t timesync_ref_local, timesync_ref_global;
+// skew of the global clock to the local clock in parts per million
+static int32_t timesync_skew;
+// time the last synchronization or piggybacked timestamp was sent and received
+static clock_time_t timesync_last_sent, timesync_last_heard;
+
+/**
+ * Local time in rtimer ticks, the 16 bit rtimer is extended to 32 bit.
+ * It must be read at least once per rtimer wrap around, the beacon process does this.
+*/
+static uint32_t timesync_local_time() {
+    static rtimer_clock_t last;
+    static uint16_t high;
+    rtimer_clock_t now = RTIMER_NOW();
+    if (now < last) {
+        high++;
+    }
+    last = now;
+    return ((uint32_t)high << 16) | now;
+}
+
 /**
- * Search a record in routing table
+ * Global time in rtimer ticks, the local time of the root extrapolated with the skew to the parent.
+ * Without synchronization it is the local time.
 */
+static uint32_t timesync_global_time() {
+    uint32_t local = timesync_local_time();
+    if (timesync_level == 0 || timesync_level == TIMESYNC_UNSYNCED) {
+        return local;
+    }
+    int32_t elapsed = local - timesync_ref_local;
+    return timesync_ref_global + elapsed + (int32_t)((int64_t)elapsed * timesync_skew / 1000000);
+}
 
-static struct table_record *search_row(struct table_record filter) {
-    struct table_record *tr = malloc(sizeof(struct table_record));
-    for (tr = list_head(routing_table); tr != NULL; tr = list_item_next(tr))
+static bool timesync_is_synced() {
+    return timesync_level != TIMESYNC_UNSYNCED;
+}
+
+/**
+ * Convert a global time difference to microseconds
+*/
+static uint32_t timesync_to_us(uint32_t ticks) {
+    return (uint64_t)ticks * 1000000 / RTIMER_SECOND;
+}
+
+/**
+ * Worst-case error of a latency computed from the global times of two nodes at the given sync levels,
+ * in microseconds. Each clock is off the root by at most TIMESYNC_HOP_ERROR per level.
+*/
+static uint32_t timesync_error_us(uint8_t level, uint8_t other_level) {
+    if (level == TIMESYNC_UNSYNCED || other_level == TIMESYNC_UNSYNCED) {
+        return UINT32_MAX;
+    }
+    return timesync_to_us(((uint32_t)level + other_level) * TIMESYNC_HOP_ERROR);
+}
+
+/**
+ * Put the global time into a broadcast that is sent now, it saves the next beacon
+*/
+static void timesync_stamp(uint8_t *level, uint32_t *time) {
+    *level = timesync_level;
+    *time = timesync_global_time();
+    if (timesync_is_synced()) {
+        timesync_last_sent = clock_time();
+    }
+}
+
+/**
+ * A neighbour sent its global time. It is taken over if the neighbour is closer to the root than
+ * this node, or is the time parent. Two timestamps of the same parent give the skew of the clocks.
+ * The time is taken when the packet is handed to this node, the MAC delay of the sender is not known,
+ * each level adds up to TIMESYNC_HOP_ERROR to the error of the global time.
+*/
+static void timesync_input(uint8_t level, uint32_t time, const linkaddr_t *from) {
+    uint32_t local = timesync_local_time();
+    if (level == TIMESYNC_UNSYNCED || timesync_level == 0) {
+        return;
+    }
+    bool from_parent = timesync_is_synced() && linkaddr_cmp(from, &timesync_parent);
+    if (!from_parent && level + 1 >= timesync_level) {
+        return;
+    }
+    if (from_parent) {
+        int32_t local_elapsed = local - timesync_ref_local;
+        int32_t global_elapsed = time - timesync_ref_global;
+        if (local_elapsed > 0) {
+            int32_t skew = (int64_t)(global_elapsed - local_elapsed) * 1000000 / local_elapsed;
+            if (skew > -TIMESYNC_MAX_SKEW && skew < TIMESYNC_MAX_SKEW) {
+                // smooth the estimate, a single timestamp has the MAC delay in it
+                timesync_skew = (timesync_skew + skew) / 2;
+            }
+        }
+    } else {
+        printf("TIMESYNC parent %d.%d level %u \n", from->u8[0], from->u8[1], level + 1);
+        linkaddr_copy(&timesync_parent, from);
+        timesync_skew = 0;
+    }
+    timesync_level = level + 1;
+    timesync_ref_local = local;
+    timesync_ref_global = time;
+    timesync_last_heard = clock_time();
+}
+
+static void timesync_recv(struct broadcast_conn *c, const linkaddr_t *from) {
+    struct timesync_beacon beacon;
+    memcpy(&beacon, packetbuf_dataptr(), sizeof(beacon));
+    timesync_input(beacon.level, beacon.time, from);
+}
+
+static const struct broadcast_callbacks timesync_cb = {timesync_recv};
+
+/**
+ * Find the link estimate of a neighbour
+*/
+static struct neighbour_record *search_neighbour(const linkaddr_t *addr) {
+    struct neighbour_record *n;
+    for (n = list_head(neighbour_table); n != NULL; n = list_item_next(n))
     {
-        if (linkaddr_cmp(&tr->dest_addr, &filter.dest_addr)) {
-            // found on based of destination address
-            return tr;
+        if (linkaddr_cmp(&n->addr, addr)) {
+            return n;
         }
     }
-    free(tr);
     return NULL;
 }
 
 /**
- * Create a new entry in routing table
+ * Smooth a new ETX sample into the estimate of a neighbour, a new neighbour starts with the sample
 */
-static void insert_row(struct route_msg msg, const linkaddr_t *from) {
-    struct table_record *tr = NULL;
-    tr = memb_alloc(&routing_table_mem);
-    linkaddr_copy((linkaddr_t *)&tr->dest_addr, &msg.source_addr);
-    linkaddr_copy((linkaddr_t *)&tr->next_addr, from);
-    tr->dest_seq = msg.source_seq;
-    tr->distance = msg.distance;
-    tr->broadcast_id = msg.broadcast_id;
-
-    // create a new entry in routing table if it not exists previously
-    struct table_record filter;
-    struct table_record *table_entry = NULL;
-    linkaddr_copy((linkaddr_t *)&filter.dest_addr, &msg.source_addr);
-    table_entry = search_row(filter);
-    if (table_entry != NULL) {
-        linkaddr_copy((linkaddr_t *)&table_entry->dest_addr, &msg.source_addr);
-        linkaddr_copy((linkaddr_t *)&table_entry->next_addr, from);
-        table_entry->dest_seq = msg.source_seq;
-        table_entry->distance = msg.distance;
-        table_entry->broadcast_id = msg.broadcast_id;
-        free(table_entry);
+static void update_link_estimate(const linkaddr_t *addr, uint16_t sample) {
+    struct neighbour_record *n = search_neighbour(addr);
+    if (n == NULL) {
+        n = memb_alloc(&neighbour_table_mem);
+        if (n == NULL) {
+            // table is full, reuse the neighbour heard from least recently
+            n = list_chop(neighbour_table);
+        }
+        linkaddr_copy(&n->addr, addr);
+        n->etx = sample;
+        n->blacklisted = false;
+        n->cluster_role = CLUSTER_NONE;
+        n->cluster_heard = 0;
     } else {
-        list_push(routing_table, tr);
+        list_remove(neighbour_table, n);
+        n->etx = ((uint32_t)n->etx * ETX_ALPHA + (uint32_t)sample * (100 - ETX_ALPHA)) / 100;
     }
+    // the most recently heard neighbour is kept at the head
+    list_push(neighbour_table, n);
 }
 
 /**
- * This function inserts or updates a route in routing table on RREP (route reply request)
+ * Turn the RSSI and LQI of the packet in packetbuf into an ETX sample for the link it was received on
 */
-static bool upsert_route_for_REP(struct route_msg msg, const linkaddr_t *from) {
-    struct table_record filter;
-    linkaddr_copy((linkaddr_t *)&filter.dest_addr, &msg.source_addr);
-    struct table_record *table_entry = search_row(filter);
-    // Check if RREP for this request is already sent, if it is already sent
-    if (table_entry != NULL && table_entry->broadcast_id == msg.broadcast_id) {
-        printf("This RREP is already sent------------------------------------------- \n");
-        // this RREP is already forwarded, only resend it if either
-        // 1. This RREP has greater dest seq number OR
-        // 2. Same dest seq number with smaller hop count
-        if ((msg.dest_seq > table_entry->dest_seq ) || 
-            (msg.dest_seq == table_entry->dest_seq && table_entry->distance > msg.distance)) {
-            printf("This is a better route and is updated in routing table \n");
-            // update the route infromation in table
-            table_entry->distance = msg.distance;
-            linkaddr_copy((linkaddr_t *)&table_entry->next_addr, from);
-            table_entry->dest_seq = msg.source_seq;
-        } else {
-            // don't reforward RREP
-            return false;
-        }
+static void estimate_link_from_packetbuf(const linkaddr_t *from) {
+    int16_t lqi = packetbuf_attr(PACKETBUF_ATTR_LINK_QUALITY);
+    int16_t rssi = (int8_t)packetbuf_attr(PACKETBUF_ATTR_RSSI);
+    uint16_t sample;
+    if (lqi <= LQI_MIN) {
+        sample = ETX_MAX;
+    } else if (lqi >= LQI_MAX) {
+        sample = ETX_SCALE;
     } else {
-        // set forward pointer i.e store the information in routing table
-        insert_row(msg, from);
+        // the delivery ratio grows roughly linearly with the LQI, ETX is its inverse
+        sample = (uint16_t)(ETX_SCALE * (LQI_MAX - LQI_MIN) / (lqi - LQI_MIN));
+    }
+    if (rssi < RSSI_WEAK) {
+        sample += ETX_SCALE;
+    }
+    if (sample > ETX_MAX) {
+        sample = ETX_MAX;
+    }
+    update_link_estimate(from, sample);
+}
+
+/**
+ * A RREP could not be delivered to a neighbour whose RREQ we heard, so the link only works
+ * towards us. Ignore the RREQs of this neighbour for a while.
+*/
+static void blacklist_neighbour(const linkaddr_t *addr) {
+    struct neighbour_record *n = search_neighbour(addr);
+    if (n == NULL) {
+        return;
+    }
+    n->blacklisted = true;
+    timer_set(&n->blacklist, CLOCK_SECOND * BLACKLIST_TIMEOUT);
+    printf("Neighbour %d.%d blacklisted, the link to it is unidirectional \n", addr->u8[0], addr->u8[1]);
+}
+
+/**
+ * Check if a neighbour is blacklisted, the blacklisting ends by itself after BLACKLIST_TIMEOUT
+*/
+static bool is_blacklisted(const linkaddr_t *addr) {
+    struct neighbour_record *n = search_neighbour(addr);
+    if (n == NULL || !n->blacklisted) {
+        return false;
+    }
+    if (timer_expired(&n->blacklist)) {
+        n->blacklisted = false;
+        return false;
     }
     return true;
 }
 
 /**
- * Print the routing table.
+ * The cost of the link to a neighbour, neighbours that were never heard get the worst cost
 */
-static void print_routing_table()
-{
-    printf("printing routing table \n");
-    struct table_record *tr = NULL;
-    uint8_t row = 1;
-    // print the contents of routing table
-    for (tr = list_head(routing_table); tr != NULL; tr = list_item_next(tr))
+static uint16_t link_cost(const linkaddr_t *addr) {
+    struct neighbour_record *n = search_neighbour(addr);
+    if (n == NULL) {
+        return ETX_MAX;
+    }
+    return n->etx;
+}
+
+/******************************************************************************/
+/*
+ * Cluster election
+ * Every node sends a hello with its role and score every CLUSTER_INTERVAL seconds. A node without
+ * a cluster joins the best head it hears, and becomes head itself when no neighbour without a
+ * cluster has a better score. At the start of every round all nodes drop their role and elect again,
+ * the rounds follow the global time so they start together.
+ */
+
+// role of this node in the current round and the head of its cluster
+static uint8_t cluster_role = CLUSTER_NONE;
+static linkaddr_t cluster_head;
+static uint8_t cluster_round;
+// a member that hears another cluster, it relays RREQs between the clusters
+static bool cluster_gateway = false;
+// the members of the cluster of this node, from the last hello of its head
+static linkaddr_t cluster_members[CLUSTER_HELLO_MEMBERS];
+static uint8_t cluster_member_count = 0;
+
+static uint8_t cluster_current_round() {
+    return (uint8_t)(timesync_global_time() / ((uint32_t)CLUSTER_ROUND * RTIMER_SECOND));
+}
+
+/**
+ * Share of the energy budget left in percent, the radio is what drains the battery
+*/
+static uint8_t cluster_energy() {
+    energest_flush();
+    unsigned long radio = (energest_type_time(ENERGEST_TYPE_LISTEN) + energest_type_time(ENERGEST_TYPE_TRANSMIT)) / RTIMER_SECOND;
+    if (radio >= CLUSTER_ENERGY_BUDGET) {
+        return 0;
+    }
+    return 100 - radio * 100 / CLUSTER_ENERGY_BUDGET;
+}
+
+/**
+ * A neighbour whose hello of the current round was heard recently
+*/
+static bool cluster_neighbour_alive(const struct neighbour_record *n) {
+    return n->cluster_heard != 0 && n->cluster_round == cluster_round && !n->blacklisted
+        && clock_time() - n->cluster_heard < (clock_time_t)CLOCK_SECOND * CLUSTER_INTERVAL * CLUSTER_TIMEOUT;
+}
+
+static uint8_t cluster_degree() {
+    struct neighbour_record *n;
+    uint8_t degree = 0;
+    for (n = list_head(neighbour_table); n != NULL; n = list_item_next(n))
     {
-        printf("row %u: dest addr %d.%d, next %d.%d, distance %u, dest seq %lu, broadcast id %lu \n",row, tr->dest_addr.u8[0], tr->dest_addr.u8[1], tr->next_addr.u8[0], tr->next_addr.u8[1] , tr->distance, tr->dest_seq, tr->broadcast_id);
-        row++;
+        if (cluster_neighbour_alive(n)) {
+            degree++;
+        }
+    }
+    return degree;
+}
+
+/**
+ * Residual energy first, the number of neighbours decides between nodes with about the same energy
+*/
+static uint16_t cluster_score() {
+    return (uint16_t)cluster_energy() * CLUSTER_ENERGY_WEIGHT + cluster_degree();
+}
+
+/**
+ * True if the first node is the better head, equal scores are decided by the address
+*/
+static bool cluster_better(uint16_t score, const linkaddr_t *addr, uint16_t other_score, const linkaddr_t *other_addr) {
+    if (score != other_score) {
+        return score > other_score;
+    }
+    return addr->u8[0] != other_addr->u8[0] ? addr->u8[0] > other_addr->u8[0] : addr->u8[1] > other_addr->u8[1];
+}
+
+/**
+ * True if the node is a member of the cluster of this head
+*/
+static bool cluster_is_member(const linkaddr_t *addr) {
+    struct neighbour_record *n = search_neighbour(addr);
+    return cluster_role == CLUSTER_HEAD && n != NULL && cluster_neighbour_alive(n)
+        && n->cluster_role == CLUSTER_MEMBER && linkaddr_cmp(&n->cluster_head, &linkaddr_node_addr);
+}
+
+/**
+ * True if the node is in the cluster of this node, as far as the head listed its members
+*/
+static bool cluster_contains(const linkaddr_t *addr) {
+    uint8_t i;
+    if (cluster_role == CLUSTER_NONE) {
+        return false;
+    }
+    if (linkaddr_cmp(addr, &cluster_head) || cluster_is_member(addr)) {
+        return true;
+    }
+    for (i = 0; i < cluster_member_count; i++) {
+        if (linkaddr_cmp(addr, &cluster_members[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * The largest TTL a RREQ for a destination needs when this node relays it, 0 if there is no limit.
+ * Every member is a neighbour of its head, so a head needs one more hop and a gateway two.
+*/
+static uint8_t cluster_rreq_ttl(const linkaddr_t *dest_addr) {
+    if (!AODV_CLUSTER || !cluster_contains(dest_addr)) {
+        return 0;
+    }
+    return cluster_role == CLUSTER_HEAD ? 2 : 3;
+}
+
+/**
+ * Heads and gateways relay RREQs, and nodes that have no cluster yet so the network works while it forms
+*/
+static bool cluster_is_backbone() {
+    return !AODV_CLUSTER || cluster_role != CLUSTER_MEMBER || cluster_gateway;
+}
+
+/**
+ * Update the role of this node from the hellos heard
+*/
+static void cluster_elect(uint16_t score) {
+    struct neighbour_record *n;
+    struct neighbour_record *best_head = NULL;
+    bool better_contender = false;
+    uint8_t round = cluster_current_round();
+    if (round != cluster_round) {
+        // a new round, every node elects again
+        cluster_round = round;
+        cluster_role = CLUSTER_NONE;
+    }
+    for (n = list_head(neighbour_table); n != NULL; n = list_item_next(n))
+    {
+        if (!cluster_neighbour_alive(n)) {
+            continue;
+        }
+        if (n->cluster_role == CLUSTER_HEAD && (best_head == NULL || cluster_better(n->cluster_score, &n->addr, best_head->cluster_score, &best_head->addr))) {
+            best_head = n;
+        } else if (n->cluster_role == CLUSTER_NONE && cluster_better(n->cluster_score, &n->addr, score, &linkaddr_node_addr)) {
+            better_contender = true;
+        }
+    }
+    if (cluster_role == CLUSTER_MEMBER) {
+        n = search_neighbour(&cluster_head);
+        if (n == NULL || !cluster_neighbour_alive(n) || n->cluster_role != CLUSTER_HEAD) {
+            printf("CLUSTER head %d.%d lost \n", cluster_head.u8[0], cluster_head.u8[1]);
+            cluster_role = CLUSTER_NONE;
+        }
+    }
+    if (cluster_role != CLUSTER_MEMBER) {
+        cluster_member_count = 0;
+    }
+    if (cluster_role == CLUSTER_NONE) {
+        if (best_head != NULL) {
+            cluster_role = CLUSTER_MEMBER;
+            linkaddr_copy(&cluster_head, &best_head->addr);
+            printf("CLUSTER member of %d.%d round %u \n", cluster_head.u8[0], cluster_head.u8[1], cluster_round);
+        } else if (!better_contender) {
+            cluster_role = CLUSTER_HEAD;
+            linkaddr_copy(&cluster_head, &linkaddr_node_addr);
+            printf("CLUSTER head round %u score %u \n", cluster_round, score);
+        }
+    }
+
+    // a member next to a node of another cluster links the two clusters
+    bool gateway = false;
+    if (cluster_role == CLUSTER_MEMBER) {
+        for (n = list_head(neighbour_table); n != NULL; n = list_item_next(n))
+        {
+            if (cluster_neighbour_alive(n) && n->cluster_role != CLUSTER_NONE && !linkaddr_cmp(&n->cluster_head, &cluster_head)) {
+                gateway = true;
+                break;
+            }
+        }
+    }
+    if (gateway != cluster_gateway) {
+        cluster_gateway = gateway;
+        printf("CLUSTER gateway %u \n", gateway);
+    }
+}
+
+static void send_cluster_hello() {
+    struct cluster_hello hello;
+    hello.score = cluster_score();
+    cluster_elect(hello.score);
+    hello.role = cluster_role;
+    hello.round = cluster_round;
+    linkaddr_copy(&hello.head, &cluster_head);
+    hello.member_count = 0;
+    if (cluster_role == CLUSTER_HEAD) {
+        struct neighbour_record *n;
+        for (n = list_head(neighbour_table); n != NULL && hello.member_count < CLUSTER_HELLO_MEMBERS; n = list_item_next(n))
+        {
+            if (cluster_is_member(&n->addr)) {
+                linkaddr_copy(&hello.members[hello.member_count++], &n->addr);
+            }
+        }
+    }
+    packetbuf_copyfrom(&hello, offsetof(struct cluster_hello, members) + hello.member_count * sizeof(linkaddr_t));
+    printf("CTRL hello role %u head %d.%d \n", hello.role, hello.head.u8[0], hello.head.u8[1]);
+    broadcast_send(&cluster_bc);
+}
+
+static void cluster_recv(struct broadcast_conn *c, const linkaddr_t *from) {
+    struct cluster_hello hello;
+    if (packetbuf_datalen() < offsetof(struct cluster_hello, members)) {
+        return;
+    }
+    memcpy(&hello, packetbuf_dataptr(), packetbuf_datalen() < sizeof(hello) ? packetbuf_datalen() : sizeof(hello));
+    if (hello.member_count > CLUSTER_HELLO_MEMBERS || offsetof(struct cluster_hello, members) + hello.member_count * sizeof(linkaddr_t) > packetbuf_datalen()) {
+        return;
+    }
+    estimate_link_from_packetbuf(from);
+    struct neighbour_record *n = search_neighbour(from);
+    if (n == NULL) {
+        return;
+    }
+    n->cluster_role = hello.role;
+    n->cluster_round = hello.round;
+    linkaddr_copy(&n->cluster_head, &hello.head);
+    n->cluster_score = hello.score;
+    n->cluster_heard = clock_time();
+    if (n->cluster_heard == 0) {
+        // 0 means never heard
+        n->cluster_heard = 1;
+    }
+    if (cluster_role == CLUSTER_MEMBER && hello.role == CLUSTER_HEAD && linkaddr_cmp(from, &cluster_head)) {
+        // the gateways of the cluster keep discoveries for its members local
+        cluster_member_count = hello.member_count;
+        memcpy(cluster_members, hello.members, hello.member_count * sizeof(linkaddr_t));
+    }
+}
+
+static const struct broadcast_callbacks cluster_cb = {cluster_recv};
+
+/**
+ * Search a record in routing table by destination address
+ * The returned row is owned by the routing table, callers may change it in place
+*/
+static struct table_record *search_row(const linkaddr_t *dest_addr) {
+    struct table_record *tr;
+    for (tr = list_head(routing_table); tr != NULL; tr = list_item_next(tr))
+    {
+        if (linkaddr_cmp(&tr->dest_addr, dest_addr)) {
+            // found on based of destination address
+            return tr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Add an alternate next hop to a route. The next hop must differ from the primary and from the
+ * other alternates (link-disjoint), and it must not be further away than the primary route,
+ * which keeps the alternates loop-free as in AOMDV.
+*/
+static bool add_alternate(struct table_record *tr, const linkaddr_t *next_addr, uint8_t distance, uint16_t cost) {
+    uint8_t i;
+    if (linkaddr_cmp(&tr->next_addr, next_addr) || distance > tr->distance || tr->distance == UINT8_MAX) {
+        return false;
+    }
+    for (i = 0; i < tr->alternate_count; i++) {
+        if (linkaddr_cmp(&tr->alternates[i].next_addr, next_addr)) {
+            // already known, refresh it
+            tr->alternates[i].distance = distance;
+            tr->alternates[i].cost = cost;
+            return true;
+        }
+    }
+    if (tr->alternate_count == MAX_ALTERNATES) {
+        // replace the most expensive alternate if this one is cheaper
+        uint8_t worst = 0;
+        for (i = 1; i < MAX_ALTERNATES; i++) {
+            if (tr->alternates[i].cost > tr->alternates[worst].cost) {
+                worst = i;
+            }
+        }
+        if (tr->alternates[worst].cost <= cost) {
+            return false;
+        }
+        i = worst;
+    } else {
+        i = tr->alternate_count++;
+    }
+    linkaddr_copy(&tr->alternates[i].next_addr, next_addr);
+    tr->alternates[i].distance = distance;
+    tr->alternates[i].cost = cost;
+    printf("Alternate next hop %d.%d stored for destination %d.%d \n", next_addr->u8[0], next_addr->u8[1], tr->dest_addr.u8[0], tr->dest_addr.u8[1]);
+    return true;
+}
+
+/**
+ * Remove a next hop from the alternates of a route
+*/
+static void remove_alternate(struct table_record *tr, const linkaddr_t *next_addr) {
+    uint8_t i;
+    for (i = 0; i < tr->alternate_count; i++) {
+        if (linkaddr_cmp(&tr->alternates[i].next_addr, next_addr)) {
+            tr->alternate_count--;
+            tr->alternates[i] = tr->alternates[tr->alternate_count];
+            return;
+        }
+    }
+}
+
+/**
+ * The primary next hop of a route is broken, replace it by the cheapest alternate.
+ * Returns false if there is no alternate left, the caller then has to fall back to a RERR.
+*/
+static bool switch_to_alternate(struct table_record *tr) {
+    uint8_t i, best = 0;
+    if (tr->alternate_count == 0) {
+        return false;
+    }
+    for (i = 1; i < tr->alternate_count; i++) {
+        if (tr->alternates[i].cost < tr->alternates[best].cost) {
+            best = i;
+        }
+    }
+    linkaddr_copy(&tr->next_addr, &tr->alternates[best].next_addr);
+    tr->distance = tr->alternates[best].distance;
+    tr->cost = tr->alternates[best].cost;
+    tr->alternate_count--;
+    tr->alternates[best] = tr->alternates[tr->alternate_count];
+    printf("Switched to alternate next hop %d.%d for destination %d.%d \n", tr->next_addr.u8[0], tr->next_addr.u8[1], tr->dest_addr.u8[0], tr->dest_addr.u8[1]);
+    return true;
+}
+
+/**
+ * A link to a neighbour is broken, no route may use it as an alternate any more
+*/
+static void remove_broken_next_hop(const linkaddr_t *next_addr) {
+    struct table_record *tr;
+    for (tr = list_head(routing_table); tr != NULL; tr = list_item_next(tr))
+    {
+        remove_alternate(tr, next_addr);
+    }
+}
+
+/**
+ * A neighbour forwards to the destination of a route through this node, it gets the RERR when the route breaks.
+ * When the set is full the oldest precursor is replaced.
+*/
+static void add_precursor(struct table_record *tr, const linkaddr_t *addr) {
+    uint8_t i;
+    if (tr == NULL || linkaddr_cmp(addr, &linkaddr_node_addr) || linkaddr_cmp(addr, &tr->next_addr)) {
+        return;
+    }
+    for (i = 0; i < tr->precursor_count; i++) {
+        if (linkaddr_cmp(&tr->precursors[i], addr)) {
+            return;
+        }
+    }
+    if (tr->precursor_count == MAX_PRECURSORS) {
+        memmove(&tr->precursors[0], &tr->precursors[1], (MAX_PRECURSORS - 1) * sizeof(linkaddr_t));
+        tr->precursor_count--;
+    }
+    linkaddr_copy(&tr->precursors[tr->precursor_count++], addr);
+}
+
+/**
+ * Create a new entry in routing table for the source of a message, or update the existing one
+*/
+static void insert_row(const struct route_msg *msg, const linkaddr_t *from) {
+    struct table_record *table_entry = search_row(&msg->source_addr);
+    if (table_entry != NULL) {
+        if (msg->source_seq > table_entry->dest_seq) {
+            // alternates learned for an older sequence number may contain loops
+            table_entry->alternate_count = 0;
+        } else if (!linkaddr_cmp(&table_entry->next_addr, from) && table_entry->distance != UINT8_MAX) {
+            // keep the old next hop as an alternate, it is only added if it is not longer than the new primary
+            struct alternate_route old = {table_entry->next_addr, table_entry->distance, table_entry->cost};
+            remove_alternate(table_entry, from);
+            linkaddr_copy(&table_entry->next_addr, from);
+            table_entry->distance = msg->distance;
+            table_entry->cost = msg->cost;
+            add_alternate(table_entry, &old.next_addr, old.distance, old.cost);
+        }
+        remove_alternate(table_entry, from);
+    } else {
+        // create a new entry in routing table if it not exists previously
+        table_entry = memb_alloc(&routing_table_mem);
+        if (table_entry == NULL) {
+            printf("Routing table is full, route to %d.%d not stored \n", msg->source_addr.u8[0], msg->source_addr.u8[1]);
+            return;
+        }
+        linkaddr_copy(&table_entry->dest_addr, &msg->source_addr);
+        table_entry->alternate_count = 0;
+        table_entry->precursor_count = 0;
+        list_push(routing_table, table_entry);
+    }
+    linkaddr_copy(&table_entry->next_addr, from);
+    table_entry->dest_seq = msg->source_seq;
+    table_entry->distance = msg->distance;
+    table_entry->cost = msg->cost;
+    table_entry->broadcast_id = msg->broadcast_id;
+    table_entry->restored = false;
+}
+
+/**
+ * This function inserts or updates a route in routing table on RREP (route reply request)
+*/
+static bool upsert_route_for_REP(const struct route_msg *msg, const linkaddr_t *from) {
+    struct table_record *table_entry = search_row(&msg->source_addr);
+    // Check if RREP for this request is already sent, if it is already sent
+    if (table_entry != NULL && table_entry->broadcast_id == msg->broadcast_id) {
+        printf("This RREP is already sent------------------------------------------- \n");
+        // this RREP is already forwarded, only resend it if either
+        // 1. This RREP has greater dest seq number OR
+        // 2. Same dest seq number with smaller link cost (ETX)
+        if ((msg->dest_seq > table_entry->dest_seq ) || 
+            (msg->dest_seq == table_entry->dest_seq && table_entry->cost > msg->cost)) {
+            printf("This is a better route and is updated in routing table \n");
+            if (msg->dest_seq > table_entry->dest_seq) {
+                table_entry->alternate_count = 0;
+            }
+            // the old next hop stays usable as an alternate
+            struct alternate_route old = {table_entry->next_addr, table_entry->distance, table_entry->cost};
+            // update the route infromation in table
+            table_entry->distance = msg->distance;
+            table_entry->cost = msg->cost;
+            linkaddr_copy((linkaddr_t *)&table_entry->next_addr, from);
+            table_entry->dest_seq = msg->source_seq;
+            table_entry->restored = false;
+            remove_alternate(table_entry, from);
+            add_alternate(table_entry, &old.next_addr, old.distance, old.cost);
+        } else {
+            // don't reforward RREP, but keep its path as an alternate to destination
+            if (msg->source_seq == table_entry->dest_seq) {
+                add_alternate(table_entry, from, msg->distance, msg->cost);
+            }
+            return false;
+        }
+    } else {
+        // set forward pointer i.e store the information in routing table
+        insert_row(msg, from);
+    }
+    return true;
+}
+
+/**
+ * Learn or refresh a route from a packet this node forwarded or overheard.
+ * seq is the sequence number of the destination carried by the packet, or SEQ_UNKNOWN.
+ * A fresher sequence number always wins. Without one, an existing valid route is only replaced by a
+ * cheaper one that is not longer, and an invalid route only by the direct link to a neighbour we just heard.
+*/
+static void learn_route(const linkaddr_t *dest_addr, const linkaddr_t *next_addr, uint8_t distance, uint16_t cost, uint32_t seq) {
+    if (linkaddr_cmp(dest_addr, &linkaddr_node_addr)) {
+        return;
+    }
+    struct table_record *table_entry = search_row(dest_addr);
+    if (table_entry == NULL) {
+        table_entry = memb_alloc(&routing_table_mem);
+        if (table_entry == NULL) {
+            return;
+        }
+        linkaddr_copy(&table_entry->dest_addr, dest_addr);
+        table_entry->dest_seq = seq;
+        table_entry->broadcast_id = 0;
+        table_entry->alternate_count = 0;
+        table_entry->precursor_count = 0;
+        list_push(routing_table, table_entry);
+    } else if (seq != SEQ_UNKNOWN && seq > table_entry->dest_seq) {
+        // fresher information, older alternates may contain loops
+        table_entry->dest_seq = seq;
+        table_entry->alternate_count = 0;
+    } else if (table_entry->distance == UINT8_MAX) {
+        if (distance != 1 || !linkaddr_cmp(dest_addr, next_addr)) {
+            return;
+        }
+    } else if ((seq == SEQ_UNKNOWN || seq == table_entry->dest_seq) && cost < table_entry->cost && distance <= table_entry->distance) {
+        if (linkaddr_cmp(&table_entry->next_addr, next_addr)) {
+            table_entry->cost = cost;
+            table_entry->distance = distance;
+            table_entry->restored = false;
+            return;
+        }
+        // the old next hop stays usable as an alternate
+        struct alternate_route old = {table_entry->next_addr, table_entry->distance, table_entry->cost};
+        table_entry->distance = distance;
+        remove_alternate(table_entry, next_addr);
+        add_alternate(table_entry, &old.next_addr, old.distance, old.cost);
+    } else {
+        return;
+    }
+    linkaddr_copy(&table_entry->next_addr, next_addr);
+    table_entry->distance = distance;
+    table_entry->cost = cost;
+    table_entry->restored = false;
+    printf("Route to %d.%d learned from traffic via %d.%d, distance %u \n", dest_addr->u8[0], dest_addr->u8[1], next_addr->u8[0], next_addr->u8[1], distance);
+}
+
+/**
+ * A packet was received from a neighbour, so there is a direct route to it
+*/
+static void learn_neighbour_route(const linkaddr_t *from) {
+    if (is_blacklisted(from)) {
+        // we hear the neighbour, but it does not hear us
+        return;
+    }
+    learn_route(from, from, 1, link_cost(from), SEQ_UNKNOWN);
+}
+
+/**
+ * Print the routing table.
+*/
+static void print_routing_table()
+{
+    printf("printing routing table \n");
+    struct table_record *tr = NULL;
+    uint8_t row = 1;
+    // print the contents of routing table
+    for (tr = list_head(routing_table); tr != NULL; tr = list_item_next(tr))
+    {
+        printf("row %u: dest addr %d.%d, next %d.%d, distance %u, cost %u, dest seq %lu, broadcast id %lu \n",row, tr->dest_addr.u8[0], tr->dest_addr.u8[1], tr->next_addr.u8[0], tr->next_addr.u8[1] , tr->distance, tr->cost, tr->dest_seq, tr->broadcast_id);
+        uint8_t i;
+        for (i = 0; i < tr->alternate_count; i++) {
+            printf("       alternate next %d.%d, distance %u, cost %u \n", tr->alternates[i].next_addr.u8[0], tr->alternates[i].next_addr.u8[1], tr->alternates[i].distance, tr->alternates[i].cost);
+        }
+        row++;
+    }
+}
+
+/**
+ * Print a message
+*/
+static void print_message(const struct route_msg *msg)
+{
+    printf("message: source address: %d.%d, source seq: %lu, broadcast id: %lu, dest address: %d.%d, dest seq: %lu, hop count: %u, cost: %u \n",
+           msg->source_addr.u8[0], msg->source_addr.u8[1], msg->source_seq, msg->broadcast_id, msg->dest_addr.u8[0], msg->dest_addr.u8[1], msg->dest_seq, msg->distance, msg->cost);
+}
+
+/**
+ * Log a routing message this node sends, one line per transmission for the log analyzer
+*/
+static void log_control(const char *type, const struct route_msg *msg) {
+    printf("CTRL %s src %d.%d dest %d.%d \n", type, msg->source_addr.u8[0], msg->source_addr.u8[1], msg->dest_addr.u8[0], msg->dest_addr.u8[1]);
+}
+
+/**
+ * Send a route message over a unicast connection
+ * A message that was changed in place in packetbuf is sent as it is, any other one is copied there first
+ */
+static void send_route_msg(struct unicast_conn *c, const struct route_msg *msg, const linkaddr_t *dest) {
+    if ((const void *)msg != packetbuf_dataptr()) {
+        /* Copy data to the packet buffer */
+        packetbuf_copyfrom(msg, sizeof(struct route_msg));
+    }
+    if (msg->is_print_only) {
+        // the path printout is a diagnostic of this application, it is not counted as routing overhead
+        printf("DIAG path src %d.%d dest %d.%d \n", msg->source_addr.u8[0], msg->source_addr.u8[1], msg->dest_addr.u8[0], msg->dest_addr.u8[1]);
+    } else {
+        log_control("rrep", msg);
+    }
+    unicast_send(c, dest);
+}
+
+/**
+ * Send a unicast message
+ */
+static void send_unicast_msg(const struct route_msg *msg, const linkaddr_t *dest) {
+    send_route_msg(&uc, msg, dest);
+}
+
+/**
+ * Send a RREP, if the neighbour does not acknowledge it the link is unidirectional.
+ * The MAC layer reports the result of every RREP queued on rrep_uc with its receiver, however
+ * many are queued at the same time, see unicast_sent.
+ */
+static void send_rrep(const struct route_msg *msg, const linkaddr_t *dest) {
+    send_route_msg(&rrep_uc, msg, dest);
+}
+
+// Start broadcasting a message from source node
+// Returns false if the RREQ was not sent because this node reached its RREQ rate limit
+static bool start_broadcast(const struct route_msg *msg) {
+    if ((clock_time_t)(clock_time() - rreq_window_start) >= CLOCK_SECOND) {
+        rreq_window_start = clock_time();
+        rreq_window_count = 0;
+    }
+    if (rreq_window_count >= RREQ_RATELIMIT) {
+        printf("RREQ rate limit reached, RREQ for %d.%d not sent \n", msg->dest_addr.u8[0], msg->dest_addr.u8[1]);
+        return false;
+    }
+    rreq_window_count++;
+    /* Copy data to the packet buffer */
+    packetbuf_copyfrom(msg, sizeof(struct route_msg));
+    struct route_msg *sent = packetbuf_dataptr();
+    sent->origin_time = timesync_global_time();
+    sent->origin_level = timesync_level;
+    timesync_stamp(&sent->sync_level, &sent->sync_time);
+    log_control("rreq", msg);
+    /* Send broadcast packet RREQ */
+    broadcast_send(&broadcast);
+    return true;
+}
+
+/**
+ * Search the route discovery for a destination
+*/
+static struct discovery_record *search_discovery(const linkaddr_t *dest_addr) {
+    struct discovery_record *d;
+    for (d = list_head(discovery_list); d != NULL; d = list_item_next(d))
+    {
+        if (linkaddr_cmp(&d->rreq.dest_addr, dest_addr)) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * The route discovery for a destination is finished, either because the RREP arrived or it failed
+*/
+static void stop_discovery(struct discovery_record *d) {
+    ctimer_stop(&d->timer);
+    list_remove(discovery_list, d);
+    memb_free(&discovery_mem, d);
+}
+
+static void send_queued_ip(const linkaddr_t *dest_addr);
+static void drop_queued_ip(const linkaddr_t *dest_addr);
+static void data_repair_done(const linkaddr_t *dest_addr);
+
+/**
+ * The RREP of a route discovery did not arrive in time, retry with a new broadcast id
+ * and twice the waiting time, or give up after RREQ_RETRIES retries
+*/
+static void discovery_timeout(void *ptr) {
+    struct discovery_record *d = ptr;
+    struct table_record *table_entry = search_row(&d->rreq.dest_addr);
+    if (table_entry != NULL && table_entry->distance != UINT8_MAX) {
+        // route was found in the meantime
+        send_queued_ip(&d->rreq.dest_addr);
+        stop_discovery(d);
+        return;
+    }
+    if (d->retries == RREQ_RETRIES) {
+        printf("Route discovery for %d.%d failed after %u retries \n", d->rreq.dest_addr.u8[0], d->rreq.dest_addr.u8[1], d->retries);
+        drop_queued_ip(&d->rreq.dest_addr);
+        stop_discovery(d);
+        return;
+    }
+    d->rreq.broadcast_id = broadcast_id++;
+    if (start_broadcast(&d->rreq)) {
+        d->retries++;
+        printf("Retrying route discovery for %d.%d (retry %u) \n", d->rreq.dest_addr.u8[0], d->rreq.dest_addr.u8[1], d->retries);
+        ctimer_set(&d->timer, (CLOCK_SECOND * DISCOVERY_TIMEOUT << d->retries) + random_rand() % (CLOCK_SECOND / 4), discovery_timeout, d);
+    } else {
+        // rate limited, try again when the current window is over
+        ctimer_set(&d->timer, CLOCK_SECOND, discovery_timeout, d);
+    }
+}
+
+/**
+ * Start a route discovery, only one discovery per destination runs at a time
+*/
+static void start_discovery(const struct route_msg *msg) {
+    struct discovery_record *d = search_discovery(&msg->dest_addr);
+    if (d != NULL) {
+        printf("Route discovery for %d.%d is already running \n", msg->dest_addr.u8[0], msg->dest_addr.u8[1]);
+        return;
+    }
+    d = memb_alloc(&discovery_mem);
+    if (d == NULL) {
+        printf("Too many route discoveries running, RREQ for %d.%d not sent \n", msg->dest_addr.u8[0], msg->dest_addr.u8[1]);
+        return;
+    }
+    d->rreq = *msg;
+    d->retries = 0;
+    d->start_time = timesync_global_time();
+    list_add(discovery_list, d);
+    if (start_broadcast(msg)) {
+        ctimer_set(&d->timer, CLOCK_SECOND * DISCOVERY_TIMEOUT + random_rand() % (CLOCK_SECOND / 4), discovery_timeout, d);
+    } else {
+        ctimer_set(&d->timer, CLOCK_SECOND, discovery_timeout, d);
+    }
+}
+
+#if RREQ_JITTER > 0
+// a forwarded RREQ waiting for its jitter to pass
+static struct route_msg jittered_rreq;
+static bool jittered_rreq_pending = false;
+static struct ctimer rreq_jitter_timer;
+
+static void send_jittered_rreq(void *ptr) {
+    jittered_rreq_pending = false;
+    timesync_stamp(&jittered_rreq.sync_level, &jittered_rreq.sync_time);
+    log_control("rreq-fwd", &jittered_rreq);
+    packetbuf_copyfrom(&jittered_rreq, sizeof(struct route_msg));
+    broadcast_send(&broadcast);
+}
+#endif
+
+/**
+ * Forward a RREQ that was changed in place in packetbuf.
+ * With duty cycling every broadcast is strobed for a full wake-up interval, so all neighbours that
+ * forward the same RREQ at once would collide. It is sent after a random jitter instead, if the
+ * jitter slot is taken by another RREQ this one goes out immediately.
+*/
+static void forward_rreq(struct route_msg *msg) {
+#if RREQ_JITTER > 0
+    if (!jittered_rreq_pending) {
+        jittered_rreq = *msg;
+        jittered_rreq_pending = true;
+        ctimer_set(&rreq_jitter_timer, random_rand() % RREQ_JITTER, send_jittered_rreq, NULL);
+        return;
+    }
+#endif
+    timesync_stamp(&msg->sync_level, &msg->sync_time);
+    log_control("rreq-fwd", msg);
+    broadcast_send(&broadcast);
+}
+
+/**
+ * The route message in packetbuf, to be parsed and changed in place, or NULL if the frame is too short for one.
+ * The headers stripped by the lower layers can leave the data at an odd address, where msp430 cannot
+ * load the uint32_t fields, packetbuf_compact moves it back to the aligned start of packetbuf.
+*/
+static struct route_msg *route_msg_from_packetbuf() {
+    if (packetbuf_datalen() < sizeof(struct route_msg)) {
+        printf("Route message of %u bytes too short, dropped \n", packetbuf_datalen());
+        return NULL;
+    }
+    if ((uintptr_t)packetbuf_dataptr() % __alignof__(struct route_msg) != 0) {
+        packetbuf_compact();
+    }
+    if ((uintptr_t)packetbuf_dataptr() % __alignof__(struct route_msg) != 0) {
+        printf("Route message not aligned, dropped \n");
+        return NULL;
+    }
+    return packetbuf_dataptr();
+}
+
+/*************************************************************************/
+/* 
+ * Callback function for broadcast
+ * Called when a packet has been received by the broadcast module
+ */
+static void
+recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from) {
+    // the RREQ is parsed and changed in place in packetbuf, and forwarded from there
+    struct route_msg *msg = route_msg_from_packetbuf();
+    if (msg == NULL) {
+        return;
+    }
+    estimate_link_from_packetbuf(from);
+    timesync_input(msg->sync_level, msg->sync_time, from);
+    // our RREPs do not reach a blacklisted neighbour, answering or relaying its RREQs is wasted
+    if (is_blacklisted(from)) {
+        printf("RREQ from blacklisted neighbour %d.%d ignored \n", from->u8[0], from->u8[1]);
+        return;
+    }
+    learn_neighbour_route(from);
+    // if it is a source node and it received request from its neighbours, discard it
+    if (linkaddr_cmp(&msg->source_addr, &linkaddr_node_addr)) {
+        return;
+    }
+    // add the cost of the link the request came over, the reverse route to the source uses it
+    msg->cost += link_cost(from);
+    if (!cluster_is_backbone() && !linkaddr_cmp(&msg->dest_addr, &linkaddr_node_addr)) {
+        // only the backbone relays discoveries, a member keeps no reverse route for them
+        return;
+    }
+
+    // check if same request is received again, discard it.
+    // the source address and broadcast id uniquely identifies a request
+    struct table_record *table_entry = search_row(&msg->source_addr);
+    if (table_entry != NULL && table_entry->broadcast_id == msg->broadcast_id) {
+        // its a duplicate request, discard it
+        // but if it came over a cheaper path, use that path for the reverse route (and so for the RREP)
+        // otherwise keep its path as an alternate to the source
+        bool new_path = false;
+        if (msg->cost < table_entry->cost && table_entry->distance != UINT8_MAX && !linkaddr_cmp(&table_entry->next_addr, from)) {
+            struct alternate_route old = {table_entry->next_addr, table_entry->distance, table_entry->cost};
+            linkaddr_copy(&table_entry->next_addr, from);
+            table_entry->cost = msg->cost;
+            table_entry->distance = msg->distance;
+            remove_alternate(table_entry, from);
+            add_alternate(table_entry, &old.next_addr, old.distance, old.cost);
+            new_path = true;
+        } else {
+            new_path = add_alternate(table_entry, from, msg->distance, msg->cost);
+        }
+        if (new_path && linkaddr_cmp(&msg->dest_addr, &linkaddr_node_addr)) {
+            // this is the destination, reply over this path as well so that the nodes
+            // on it learn an alternate forward route to this node
+            uint32_t rreq_source_seq = msg->source_seq;
+            linkaddr_copy(&msg->dest_addr, &msg->source_addr);
+            linkaddr_copy(&msg->source_addr, &linkaddr_node_addr);
+            msg->source_seq = msg->dest_seq > seq_no ? msg->dest_seq : seq_no;
+            msg->dest_seq = rreq_source_seq;
+            msg->distance = 1;
+            msg->cost = 0;
+            msg->origin_time = timesync_global_time();
+            msg->origin_level = timesync_level;
+            printf("Sending RREP over alternate path via %d.%d \n", from->u8[0], from->u8[1]);
+            send_rrep(msg, from);
+        }
+        return;
+    }
+
+    // print the received message details
+	printf("broadcast message received from %d.%d: \n", from->u8[0], from->u8[1]);
+    print_message(msg);
+    bool is_destination = false; // true if this is the destination node
+    // check if current node is the destination node
+    if (linkaddr_cmp(&msg->dest_addr, &linkaddr_node_addr)) {
+        is_destination = true;
+        if (timesync_is_synced()) {
+            printf("LATENCY rreq src %d.%d hops %u us %lu err %lu \n", msg->source_addr.u8[0], msg->source_addr.u8[1], msg->distance, timesync_to_us(timesync_global_time() - msg->origin_time), timesync_error_us(timesync_level, msg->origin_level));
+        }
+        // this is the destination node, prepare a route reply RREP
+        // create a new entry in routing table
+        insert_row(msg, from);
+        // printing routing table
+        print_routing_table();
+
+        // prepare RREP (route reply)
+        // the source becomes destination
+        linkaddr_copy(&msg->dest_addr, &msg->source_addr);
+        // the destination becomes source
+        linkaddr_copy(&msg->source_addr, &linkaddr_node_addr);
+        msg->distance = 1;
+        msg->cost = 0;
+        printf("Message has received its destination. \n");
+    }
+    // check if route to destination exist in routing table, otherwise re-broadcast
+    table_entry = search_row(&msg->dest_addr);
+    const linkaddr_t *next_addr;
+
+    // an intermediate node can only reply on behalf of destination if destination
+    // sequence number in route table is grater than or equal to the one which is in REQUEST,
+    // a learned route has no sequence number and so no freshness to vouch for, it never answers a RREQ
+    bool fresh_route = table_entry != NULL && table_entry->dest_seq != SEQ_UNKNOWN && table_entry->dest_seq >= msg->dest_seq;
+    if (table_entry != NULL && (fresh_route || is_destination) && table_entry->distance != UINT8_MAX) {
+        // record found in routing table
+        printf("record found in table for destination %d.%d. Now sending RREP \n", table_entry->dest_addr.u8[0], table_entry->dest_addr.u8[1]);
+        if (!linkaddr_cmp(&msg->dest_addr, &linkaddr_node_addr) && !linkaddr_cmp(&msg->source_addr, &linkaddr_node_addr)) {
+            // This is not destination nor source node
+            // create a new entry in routing table
+            insert_row(msg, from);
+            // the source will forward to destination through this node and the destination back to the source
+            add_precursor(table_entry, from);
+            add_precursor(search_row(&msg->source_addr), &table_entry->next_addr);
+            print_routing_table();
+            // The route to destination is found on this is an intermediate node, send RREP
+            msg->dest_seq = table_entry->dest_seq;
+            msg->distance = table_entry->distance + 1;
+            msg->cost = table_entry->cost;
+            // the source becomes destination
+            linkaddr_copy(&msg->dest_addr, &msg->source_addr);
+            // the destination becomes source
+            linkaddr_copy(&msg->source_addr, &table_entry->dest_addr);
+            next_addr = from;
+        } else {
+            // this is the destination node
+            uint32_t temp_dest_seq = msg->source_seq;
+            if (msg->dest_seq > seq_no) {
+                msg->source_seq = msg->dest_seq;
+            } else {
+                msg->source_seq = seq_no;
+            }
+            msg->dest_seq = temp_dest_seq;
+            msg->distance = 1;
+            msg->cost = 0;
+            next_addr = &table_entry->next_addr;
+        }
+        
+        // start uni casting from here
+        msg->origin_time = timesync_global_time();
+        msg->origin_level = timesync_level;
+        // send unicast message
+        send_rrep(msg, next_addr);
+        // seq_no++;
+    } else {
+        // route to destination not found in routing table, re-broadcast and insert in routing table
+        insert_row(msg, from);
+        // printing routing table
+        print_routing_table();
+        process_start(&pt_delete_reverse_pointer, (linkaddr_t *)&msg->source_addr);
+        uint8_t cluster_ttl = cluster_rreq_ttl(&msg->dest_addr);
+        if (cluster_ttl > 0 && msg->ttl > cluster_ttl) {
+            // the destination is in this cluster, the head reaches it and the flood ends there
+            msg->ttl = cluster_ttl;
+        }
+        if (msg->ttl > 1) {
+            // re-broadcasting
+            msg->distance++;
+            msg->ttl--;
+            printf("Broadcasting again \n");
+            /* Send broadcast packet RREQ, it is still in the packet buffer */
+            forward_rreq(msg);
+        } else {
+            printf("RREQ time to live expired, not broadcasting again \n");
+        }
+    }
+}
+
+static const struct broadcast_callbacks broadcast_callbacks = {recv_broadcast};
+
+/*************************************************************************/
+/* 
+ * Callback function for unicast
+ * Called when a packet has been received by the broadcast module
+ */
+static void
+unicast_recv(struct unicast_conn *c, const linkaddr_t *from) {
+    estimate_link_from_packetbuf(from);
+    learn_neighbour_route(from);
+    char *ackk = packetbuf_dataptr();
+    // if the acknowledgment is received from neighbour node, exit the timer process
+    // we no longer need to send RERR because our immediate neighbour towards the destination
+    // replied back, which means the link is not broken.
+    if (strcmp(ackk, "ack") == 0 && etimer_pending()) {
+        // expire the timer
+        // etimer_stop(&et);
+        process_exit(&pt_timer);
+        return;
+    }
+    
+    // the message is parsed and changed in place in packetbuf, and forwarded from there
+    struct route_msg *msg = route_msg_from_packetbuf();
+    if (msg == NULL) {
+        return;
+    }
+
+    // search route to destination address in routing table
+    struct table_record *table_entry = search_row(&msg->dest_addr);
+
+    if (msg->is_print_only == true) {
+        // this request is only for printing route to destination
+        // every node till destination just prints its address
+        printf("%d.%d \n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+        // sending the message on changes the sender address in packetbuf, keep the previous hop for the acknowledgment
+        linkaddr_t prev_addr;
+        linkaddr_copy(&prev_addr, from);
+        if (table_entry != NULL) {
+            msg->distance++;
+            add_precursor(table_entry, &prev_addr);
+            // initiate the timer process, it keeps its own copy of the message
+            process_start(&pt_timer, (struct route_msg*)msg);
+            if (!linkaddr_cmp(&table_entry->next_addr, from)) {
+                // send unicast message
+                send_unicast_msg(msg, &table_entry->next_addr);
+            }
+        } 
+        // sending an acknowledgment back to previous neighbour
+        packetbuf_copyfrom("ack", 3);
+        unicast_send(&uc, &prev_addr);
+        return;
+    }
+    
+    // unicast message is received which means this node is on the path of RREP
+    // we need to exit the timer process which deletes reverse pointer entries
+    if (etimer_pending()) {
+        process_exit(&pt_delete_reverse_pointer);
+    }
+
+    // add the cost of the link the RREP came over, the forward route to its source uses it
+    msg->cost += link_cost(from);
+
+    printf("unicast message received from %d.%d:\n",
+           from->u8[0], from->u8[1]);
+    print_message(msg);
+
+    // check if current node is the destintation node for RREP (i.e the source which initiated RREQ)
+    if (linkaddr_cmp(&msg->dest_addr, &linkaddr_node_addr)) {
+        // this is the destination node
+        printf("Source node received acknowledgment -------------------------------------- \n");
+        printf("ROUTE dest %d.%d hops %u \n", msg->source_addr.u8[0], msg->source_addr.u8[1], msg->distance);
+        if (timesync_is_synced()) {
+            printf("LATENCY rrep src %d.%d hops %u us %lu err %lu \n", msg->source_addr.u8[0], msg->source_addr.u8[1], msg->distance, timesync_to_us(timesync_global_time() - msg->origin_time), timesync_error_us(timesync_level, msg->origin_level));
+        }
+        // this may be a re-acknowledgment due to a better route found. update the route information if required
+        // Or if this route is not saved, save it in routing table.
+        upsert_route_for_REP(msg, from);
+        print_routing_table();
+        // the route discovery for this destination is done
+        struct discovery_record *d = search_discovery(&msg->source_addr);
+        if (d != NULL) {
+            // both times are taken on this node, but a synchronization in between can move its clock
+            printf("LATENCY discovery dest %d.%d retries %u us %lu err %lu \n", msg->source_addr.u8[0], msg->source_addr.u8[1], d->retries, timesync_to_us(timesync_global_time() - d->start_time), timesync_error_us(timesync_level, timesync_level));
+            stop_discovery(d);
+        }
+        // wake up the timer process in case it is waiting for a local repair
+        process_poll(&pt_timer);
+        // the IP packets waiting for this route can go now, they overwrite the RREP in packetbuf,
+        // so the destination is copied out of it first
+        linkaddr_t route_dest;
+        linkaddr_copy(&route_dest, &msg->source_addr);
+        send_queued_ip(&route_dest);
+        // and so can the data frames held back by a local repair
+        data_repair_done(&route_dest);
+        return;
+    }
+
+    // check if route to destination exist in routing table
+    if (table_entry != NULL) {
+        // record found in routing table i.e this node has route to destination.
+        printf("record found in table for destination %d.%d \n", table_entry->dest_addr.u8[0], table_entry->dest_addr.u8[1]);
+        // send RREP on behalf of destination only if destination sequence number in
+        // routing table >= destination sequence number in request.
+        if (table_entry->dest_seq >= msg->dest_seq) {
+            if (!upsert_route_for_REP(msg, from)) {
+                return;
+            }
+            // the source of the RREQ will forward to the destination through this node, and the
+            // previous hop of the RREP back to the source
+            add_precursor(search_row(&msg->source_addr), &table_entry->next_addr);
+            add_precursor(table_entry, from);
+            print_routing_table();
+            // start uni casting from here
+            msg->distance++;
+            // send unicast message
+            send_rrep(msg, &table_entry->next_addr);
+        } else {
+            // the route is outdated
+        }
+    }
+}
+
+/**
+ * Called when the MAC layer is done with a unicast, the number of transmissions it needed
+ * is a direct ETX sample for the link to the receiver
+ */
+static void
+unicast_sent(struct unicast_conn *c, int status, int num_tx) {
+    const linkaddr_t *to = packetbuf_addr(PACKETBUF_ADDR_RECEIVER);
+    if (linkaddr_cmp(to, &linkaddr_null)) {
+        return;
+    }
+    if (status == MAC_TX_OK) {
+        update_link_estimate(to, num_tx * ETX_SCALE > ETX_MAX ? ETX_MAX : num_tx * ETX_SCALE);
+    } else if (status == MAC_TX_NOACK) {
+        update_link_estimate(to, ETX_MAX);
+    }
+    if (c == &rrep_uc && status == MAC_TX_NOACK) {
+        blacklist_neighbour(to);
+    }
+}
+
+static const struct unicast_callbacks unicast_cb = {unicast_recv, unicast_sent};
+
+/******************************************************************************/
+/*
+ * Route errors
+ * When a link breaks, every route over it that has no alternate becomes invalid. One RERR listing all of
+ * them goes to the union of their precursors, unicast if there is only one and as a local broadcast
+ * otherwise. A precursor whose own route goes through the sender invalidates it and reports it to its
+ * precursors in turn, so the stale routes are cleared up to the sources in one round.
+ */
+
+/**
+ * Send RERRs for the invalid routes that still have precursors, the precursors are told only once.
+ * One RERR lists up to RERR_MAX_DESTINATIONS destinations, more are sent until every one is covered.
+*/
+static void send_rerr() {
+    struct rerr_msg rerr;
+    struct table_record *tr;
+    linkaddr_t target;
+    uint8_t targets;
+    do {
+        rerr.count = 0;
+        targets = 0;
+        for (tr = list_head(routing_table); tr != NULL && rerr.count < RERR_MAX_DESTINATIONS; tr = list_item_next(tr))
+        {
+            if (tr->distance != UINT8_MAX || tr->precursor_count == 0) {
+                continue;
+            }
+            linkaddr_copy(&rerr.unreachable[rerr.count].dest_addr, &tr->dest_addr);
+            rerr.unreachable[rerr.count].dest_seq = tr->dest_seq;
+            rerr.count++;
+            uint8_t i;
+            for (i = 0; i < tr->precursor_count; i++) {
+                if (targets == 0) {
+                    linkaddr_copy(&target, &tr->precursors[i]);
+                    targets = 1;
+                } else if (!linkaddr_cmp(&target, &tr->precursors[i])) {
+                    targets = 2;
+                }
+            }
+            tr->precursor_count = 0;
+        }
+        if (rerr.count == 0) {
+            return;
+        }
+        packetbuf_copyfrom(&rerr, RERR_SIZE(rerr.count));
+        if (targets == 1) {
+            printf("CTRL rerr dests %u to %d.%d \n", rerr.count, target.u8[0], target.u8[1]);
+            unicast_send(&rerr_uc, &target);
+        } else {
+            printf("CTRL rerr dests %u to precursors \n", rerr.count);
+            broadcast_send(&rerr_bc);
+        }
+    } while (rerr.count == RERR_MAX_DESTINATIONS);
+}
+
+/**
+ * The link to a neighbour is broken. Every route over it switches to an alternate next hop or becomes
+ * invalid, and the precursors of the invalid ones get a RERR.
+*/
+static void link_broken(const linkaddr_t *next_addr) {
+    struct table_record *tr;
+    for (tr = list_head(routing_table); tr != NULL; tr = list_item_next(tr))
+    {
+        if (tr->distance != UINT8_MAX && linkaddr_cmp(&tr->next_addr, next_addr) && !switch_to_alternate(tr)) {
+            tr->distance = UINT8_MAX;
+        }
+    }
+    send_rerr();
+}
+
+/**
+ * A RERR arrived, the sender can no longer reach the destinations it lists
+*/
+static void rerr_input(const linkaddr_t *from) {
+    struct rerr_msg rerr;
+    uint8_t i;
+    if (packetbuf_datalen() < RERR_SIZE(0)) {
+        return;
+    }
+    memcpy(&rerr, packetbuf_dataptr(), packetbuf_datalen() < sizeof(rerr) ? packetbuf_datalen() : sizeof(rerr));
+    if (rerr.count > RERR_MAX_DESTINATIONS || RERR_SIZE(rerr.count) > packetbuf_datalen()) {
+        return;
+    }
+    estimate_link_from_packetbuf(from);
+    for (i = 0; i < rerr.count; i++) {
+        struct table_record *tr = search_row(&rerr.unreachable[i].dest_addr);
+        if (tr == NULL) {
+            continue;
+        }
+        remove_alternate(tr, from);
+        if (tr->distance == UINT8_MAX || !linkaddr_cmp(&tr->next_addr, from) || switch_to_alternate(tr)) {
+            // not affected, or repaired with an alternate next hop
+            continue;
+        }
+        tr->distance = UINT8_MAX;
+        if (rerr.unreachable[i].dest_seq > tr->dest_seq) {
+            tr->dest_seq = rerr.unreachable[i].dest_seq;
+        }
+        printf("RERR from %d.%d, destination %d.%d unreachable \n", from->u8[0], from->u8[1], tr->dest_addr.u8[0], tr->dest_addr.u8[1]);
+    }
+    // pass the destinations this node lost on to its own precursors
+    send_rerr();
+}
+
+static void rerr_unicast_recv(struct unicast_conn *c, const linkaddr_t *from) {
+    rerr_input(from);
+}
+
+static void rerr_broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from) {
+    rerr_input(from);
+}
+
+static const struct unicast_callbacks rerr_uc_cb = {rerr_unicast_recv, unicast_sent};
+static const struct broadcast_callbacks rerr_bc_cb = {rerr_broadcast_recv};
+
+/******************************************************************************/
+/*
+ * Reliable data transport over the discovered routes
+ * Every hop acknowledges each data frame and the sender retransmits it until the acknowledgment arrives.
+ * Up to DATA_WINDOW_SIZE frames per next hop are in flight at the same time instead of stop-and-wait.
+ */
+
+/**
+ * Number of data frames towards a next hop that are waiting for their acknowledgment
+*/
+static uint8_t frames_in_flight(const linkaddr_t *next_addr) {
+    struct data_frame *f;
+    uint8_t count = 0;
+    for (f = list_head(data_queue); f != NULL; f = list_item_next(f))
+    {
+        if (f->in_flight && linkaddr_cmp(&f->next_addr, next_addr)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Remove a frame from the send queue
+*/
+static void drop_frame(struct data_frame *f) {
+    ctimer_stop(&f->timer);
+    list_remove(data_queue, f);
+    memb_free(&data_queue_mem, f);
+}
+
+static void data_frame_timeout(void *ptr);
+
+/**
+ * Transmit every queued frame whose next hop still has room in its window
+*/
+static void send_queued_frames(void) {
+    struct data_frame *f;
+    for (f = list_head(data_queue); f != NULL; f = list_item_next(f))
+    {
+        if (f->in_flight || f->repairing || frames_in_flight(&f->next_addr) >= DATA_WINDOW_SIZE) {
+            continue;
+        }
+        f->in_flight = true;
+        packetbuf_copyfrom(&f->msg, DATA_HEADER_SIZE + f->msg.len);
+        unicast_send(&data_uc, &f->next_addr);
+        ctimer_set(&f->timer, DATA_RTX_TIMEOUT, data_frame_timeout, f);
+    }
+}
+
+/**
+ * Search the local repair running for a destination
+*/
+static struct data_repair *search_data_repair(const linkaddr_t *dest_addr) {
+    struct data_repair *r;
+    for (r = list_head(data_repair_list); r != NULL; r = list_item_next(r))
+    {
+        if (linkaddr_cmp(&r->dest_addr, dest_addr)) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * A local repair is over, either its RREP arrived or its time ran out. The held frames go over the
+ * new route, without one they are dropped and the precursors get the RERR that was held back.
+*/
+static void finish_data_repair(struct data_repair *r) {
+    ctimer_stop(&r->timer);
+    struct table_record *table_entry = search_row(&r->dest_addr);
+    if (table_entry != NULL) {
+        uint8_t i;
+        for (i = 0; i < r->precursor_count; i++) {
+            add_precursor(table_entry, &r->precursors[i]);
+        }
+    }
+    bool repaired = table_entry != NULL && table_entry->distance != UINT8_MAX;
+    printf("Local repair for data to %d.%d %s \n", r->dest_addr.u8[0], r->dest_addr.u8[1], repaired ? "succeeded" : "failed");
+    struct data_frame *f;
+    struct data_frame *next;
+    for (f = list_head(data_queue); f != NULL; f = next)
+    {
+        next = list_item_next(f);
+        if (!f->repairing || !linkaddr_cmp(&f->msg.dest_addr, &r->dest_addr)) {
+            continue;
+        }
+        if (repaired) {
+            linkaddr_copy(&f->next_addr, &table_entry->next_addr);
+            f->msg.hop_seq = data_hop_seq++;
+            f->repairing = false;
+            f->retries = 0;
+        } else {
+            printf("Data frame to %d.%d dropped, no route \n", f->msg.dest_addr.u8[0], f->msg.dest_addr.u8[1]);
+            drop_frame(f);
+        }
+    }
+    list_remove(data_repair_list, r);
+    memb_free(&data_repair_mem, r);
+    if (!repaired) {
+        send_rerr();
+    }
+    send_queued_frames();
+}
+
+static void data_repair_timeout(void *ptr) {
+    finish_data_repair(ptr);
+}
+
+/**
+ * The RREP of a route discovery from this node arrived, finish the local repair waiting for it
+*/
+static void data_repair_done(const linkaddr_t *dest_addr) {
+    struct data_repair *r = search_data_repair(dest_addr);
+    if (r != NULL) {
+        finish_data_repair(r);
+    }
+}
+
+/**
+ * The route to a destination of queued frames broke and it has no alternate. As in pt_timer, a node that
+ * is neither the source nor far from the destination searches a new route with a small RREQ before the
+ * route is given up. Returns false if no repair was started, then the route is invalidated as usual.
+*/
+static bool start_data_repair(struct table_record *tr, const struct data_msg *msg) {
+    if (tr->distance > MAX_REPAIR_DISTANCE || linkaddr_cmp(&msg->source_addr, &linkaddr_node_addr)
+        || search_data_repair(&tr->dest_addr) != NULL) {
+        return false;
+    }
+    struct data_repair *r = memb_alloc(&data_repair_mem);
+    if (r == NULL) {
+        return false;
+    }
+    struct route_msg rreq;
+    memset(&rreq, 0, sizeof(rreq));
+    linkaddr_copy(&rreq.source_addr, &linkaddr_node_addr);
+    linkaddr_copy(&rreq.dest_addr, &tr->dest_addr);
+    rreq.source_seq = seq_no;
+    rreq.broadcast_id = broadcast_id++;
+    rreq.dest_seq = tr->dest_seq + 1;
+    rreq.distance = 1;
+    rreq.ttl = tr->distance + LOCAL_ADD_TTL;
+    rreq.is_print_only = false;
+    // the RREQ rate limit may refuse it, then there is nothing to wait for
+    if (!start_broadcast(&rreq)) {
+        memb_free(&data_repair_mem, r);
+        return false;
+    }
+    printf("Starting local repair for data to %d.%d \n", tr->dest_addr.u8[0], tr->dest_addr.u8[1]);
+    linkaddr_copy(&r->dest_addr, &tr->dest_addr);
+    // the precursors are only told about this destination if the local repair fails
+    r->precursor_count = tr->precursor_count;
+    memcpy(r->precursors, tr->precursors, sizeof(r->precursors));
+    tr->precursor_count = 0;
+    tr->distance = UINT8_MAX;
+    list_add(data_repair_list, r);
+    ctimer_set(&r->timer, CLOCK_SECOND * LOCAL_REPAIR_TIMEOUT, data_repair_timeout, r);
+    return true;
+}
+
+/**
+ * The acknowledgment of a frame did not arrive in time, send it again or give up on the link
+*/
+static void data_frame_timeout(void *ptr) {
+    struct data_frame *f = ptr;
+    f->in_flight = false;
+    if (++f->retries <= DATA_MAX_RETRANSMISSIONS) {
+        // the frame keeps its place in the queue and its hop sequence number, so the receiver detects the copy
+        send_queued_frames();
+        return;
+    }
+    printf("Data frame to %d.%d not acknowledged by %d.%d, link is broken \n", f->msg.dest_addr.u8[0], f->msg.dest_addr.u8[1], f->next_addr.u8[0], f->next_addr.u8[1]);
+    linkaddr_t broken;
+    linkaddr_copy(&broken, &f->next_addr);
+    update_link_estimate(&broken, ETX_MAX);
+    remove_broken_next_hop(&broken);
+    // the routes of the queued frames switch to an alternate or are repaired locally if they can, before
+    // link_broken invalidates the rest and sends the RERR. The neighbour itself as destination cannot be repaired
+    struct data_frame *next;
+    for (f = list_head(data_queue); f != NULL; f = list_item_next(f))
+    {
+        if (f->msg.type == DATA_TYPE_AGGREGATE || !linkaddr_cmp(&f->next_addr, &broken) || linkaddr_cmp(&f->msg.dest_addr, &broken)) {
+            continue;
+        }
+        struct table_record *table_entry = search_row(&f->msg.dest_addr);
+        if (table_entry != NULL && table_entry->distance != UINT8_MAX && linkaddr_cmp(&table_entry->next_addr, &broken)
+            && !switch_to_alternate(table_entry)) {
+            start_data_repair(table_entry, &f->msg);
+        }
+    }
+    link_broken(&broken);
+    // every frame queued or in flight to the neighbour moves over to the new next hop of its destination,
+    // or waits for the local repair of its route. Frames without a route are dropped, and so are aggregates,
+    // they are addressed to the neighbour itself
+    for (f = list_head(data_queue); f != NULL; f = next)
+    {
+        next = list_item_next(f);
+        if (!linkaddr_cmp(&f->next_addr, &broken)) {
+            continue;
+        }
+        struct table_record *table_entry = search_row(&f->msg.dest_addr);
+        if (f->msg.type != DATA_TYPE_AGGREGATE && table_entry != NULL && table_entry->distance != UINT8_MAX) {
+            ctimer_stop(&f->timer);
+            linkaddr_copy(&f->next_addr, &table_entry->next_addr);
+            // a new hop sequence number, the new next hop must not take it for a copy of an earlier frame
+            f->msg.hop_seq = data_hop_seq++;
+            f->in_flight = false;
+            f->retries = 0;
+        } else if (f->msg.type != DATA_TYPE_AGGREGATE && search_data_repair(&f->msg.dest_addr) != NULL) {
+            ctimer_stop(&f->timer);
+            f->in_flight = false;
+            f->repairing = true;
+        } else {
+            printf("Data frame to %d.%d dropped, no route \n", f->msg.dest_addr.u8[0], f->msg.dest_addr.u8[1]);
+            drop_frame(f);
+        }
+    }
+    send_queued_frames();
+}
+
+/**
+ * Queue a data frame for a next hop, returns false if the queue is full
+*/
+static bool enqueue_frame(const struct data_msg *msg, const linkaddr_t *next_addr) {
+    if (msg->len > DATA_PAYLOAD_SIZE) {
+        return false;
+    }
+    struct data_frame *f = memb_alloc(&data_queue_mem);
+    if (f == NULL) {
+        printf("Data queue is full, frame to %d.%d dropped \n", msg->dest_addr.u8[0], msg->dest_addr.u8[1]);
+        return false;
+    }
+    memcpy(&f->msg, msg, DATA_HEADER_SIZE + msg->len);
+    linkaddr_copy(&f->next_addr, next_addr);
+    f->msg.hop_seq = data_hop_seq++;
+    f->retries = 0;
+    f->in_flight = false;
+    f->repairing = false;
+    list_add(data_queue, f);
+    send_queued_frames();
+    return true;
+}
+
+/**
+ * Queue a data frame towards its destination, returns false if there is no route or the queue is full
+*/
+static bool enqueue_data(const struct data_msg *msg) {
+    struct table_record *table_entry = search_row(&msg->dest_addr);
+    if (table_entry == NULL || table_entry->distance == UINT8_MAX) {
+        printf("No route to %d.%d for data frame \n", msg->dest_addr.u8[0], msg->dest_addr.u8[1]);
+        return false;
+    }
+    return enqueue_frame(msg, &table_entry->next_addr);
+}
+
+/**
+ * Find the aggregation buffer of a next hop
+*/
+static struct aggregate_buffer *search_aggregate(const linkaddr_t *next_addr) {
+    struct aggregate_buffer *b;
+    for (b = list_head(aggregate_list); b != NULL; b = list_item_next(b))
+    {
+        if (linkaddr_cmp(&b->next_addr, next_addr)) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Send the messages batched for a next hop as one reliable frame
+*/
+static void flush_aggregate(struct aggregate_buffer *b) {
+    struct data_msg msg;
+    msg.type = DATA_TYPE_AGGREGATE;
+    linkaddr_copy(&msg.source_addr, &linkaddr_node_addr);
+    linkaddr_copy(&msg.dest_addr, &b->next_addr);
+    msg.hops = 0;
+    msg.cost = 0;
+    msg.len = b->len;
+    memcpy(msg.payload, b->data, b->len);
+    printf("Sending %u aggregated messages to %d.%d in one frame \n", b->count, b->next_addr.u8[0], b->next_addr.u8[1]);
+    ctimer_stop(&b->timer);
+    list_remove(aggregate_list, b);
+    memb_free(&aggregate_mem, b);
+    enqueue_frame(&msg, &msg.dest_addr);
+}
+
+/**
+ * The aggregation delay of a buffer is over, send what it holds
+*/
+static void aggregate_timeout(void *ptr) {
+    flush_aggregate(ptr);
+}
+
+/**
+ * Add a small message to the aggregation buffer of its next hop. The buffer is sent when the next
+ * message does not fit any more, or at the latest AGGREGATION_DELAY after its first message.
+*/
+static bool aggregate_data(const linkaddr_t *source_addr, const linkaddr_t *dest_addr, const void *payload, uint8_t len) {
+    if (AGGREGATE_RECORD_HEADER + len > DATA_PAYLOAD_SIZE) {
+        return false;
+    }
+    struct table_record *table_entry = search_row(dest_addr);
+    if (table_entry == NULL || table_entry->distance == UINT8_MAX) {
+        printf("No route to %d.%d for data message \n", dest_addr->u8[0], dest_addr->u8[1]);
+        return false;
+    }
+    struct aggregate_buffer *b = search_aggregate(&table_entry->next_addr);
+    if (b != NULL && b->len + AGGREGATE_RECORD_HEADER + len > DATA_PAYLOAD_SIZE) {
+        flush_aggregate(b);
+        b = NULL;
+    }
+    if (b == NULL) {
+        b = memb_alloc(&aggregate_mem);
+        if (b == NULL) {
+            printf("No aggregation buffer free, message to %d.%d dropped \n", dest_addr->u8[0], dest_addr->u8[1]);
+            return false;
+        }
+        linkaddr_copy(&b->next_addr, &table_entry->next_addr);
+        b->len = 0;
+        b->count = 0;
+        list_add(aggregate_list, b);
+        ctimer_set(&b->timer, AGGREGATION_DELAY, aggregate_timeout, b);
+    }
+    // record: source address, destination address, length, payload
+    memcpy(&b->data[b->len], source_addr, sizeof(linkaddr_t));
+    memcpy(&b->data[b->len + sizeof(linkaddr_t)], dest_addr, sizeof(linkaddr_t));
+    b->data[b->len + 2 * sizeof(linkaddr_t)] = len;
+    memcpy(&b->data[b->len + AGGREGATE_RECORD_HEADER], payload, len);
+    b->len += AGGREGATE_RECORD_HEADER + len;
+    b->count++;
+    if (b->len + AGGREGATE_RECORD_HEADER >= DATA_PAYLOAD_SIZE) {
+        // not even an empty message fits any more
+        flush_aggregate(b);
+    }
+    return true;
+}
+
+/**
+ * Deliver a data message if it is for this node, otherwise pass it on towards its destination
+*/
+/**
+ * Application data for this node arrived. Packets of the traffic generator are logged
+ * with their timestamps, so latency and loss can be computed from the log.
+*/
+static void deliver_data(const linkaddr_t *source_addr, const uint8_t *payload, uint8_t len) {
+    struct traffic_msg t;
+    if (len == sizeof(t) && payload[0] == TRAFFIC_MAGIC) {
+        memcpy(&t, payload, sizeof(t));
+        uint32_t now = timesync_global_time();
+        printf("TRAFFIC rx src %d.%d seq %u phase %u sent %lu recv %lu latency %lu us err %lu us \n", source_addr->u8[0], source_addr->u8[1], t.seq, t.phase, t.timestamp, now, timesync_to_us(now - t.timestamp), timesync_error_us(timesync_level, t.level));
+        return;
+    }
+    struct sensor_reading r;
+    if (len == sizeof(r) && payload[0] == SENSE_MAGIC) {
+        memcpy(&r, payload, sizeof(r));
+        printf("SENSE raw src %d.%d light %d temperature %d \n", source_addr->u8[0], source_addr->u8[1], r.values[SENSOR_LIGHT], r.values[SENSOR_TEMPERATURE]);
+        return;
+    }
+    printf("Data received from %d.%d, %u bytes \n", source_addr->u8[0], source_addr->u8[1], len);
+}
+
+static void deliver_or_aggregate(const linkaddr_t *source_addr, const linkaddr_t *dest_addr, const uint8_t *payload, uint8_t len) {
+    if (linkaddr_cmp(dest_addr, &linkaddr_node_addr)) {
+        deliver_data(source_addr, payload, len);
+    } else {
+        aggregate_data(source_addr, dest_addr, payload, len);
+    }
+}
+
+/**
+ * Unpack the messages of an aggregated frame
+*/
+static void unpack_aggregate(const struct data_msg *msg) {
+    uint8_t pos = 0;
+    while (pos + AGGREGATE_RECORD_HEADER <= msg->len) {
+        linkaddr_t source_addr, dest_addr;
+        memcpy(&source_addr, &msg->payload[pos], sizeof(linkaddr_t));
+        memcpy(&dest_addr, &msg->payload[pos + sizeof(linkaddr_t)], sizeof(linkaddr_t));
+        uint8_t len = msg->payload[pos + 2 * sizeof(linkaddr_t)];
+        if (pos + AGGREGATE_RECORD_HEADER + len > msg->len) {
+            break;
+        }
+        deliver_or_aggregate(&source_addr, &dest_addr, &msg->payload[pos + AGGREGATE_RECORD_HEADER], len);
+        pos += AGGREGATE_RECORD_HEADER + len;
+    }
+}
+
+
+/**
+ * Send application data reliably to a destination over its route
+ * Small messages are batched with others for the same next hop, unless aggregate is false
+*/
+static bool send_data(const linkaddr_t *dest_addr, const void *payload, uint8_t len, bool aggregate) {
+    struct data_msg msg;
+    if (len > DATA_PAYLOAD_SIZE) {
+        return false;
+    }
+    if (AODV_AGGREGATE && aggregate && len <= AGGREGATE_MAX_LEN) {
+        return aggregate_data(&linkaddr_node_addr, dest_addr, payload, len);
+    }
+    msg.type = DATA_TYPE_DATA;
+    linkaddr_copy(&msg.source_addr, &linkaddr_node_addr);
+    linkaddr_copy(&msg.dest_addr, dest_addr);
+    msg.hops = 0;
+    msg.cost = 0;
+    msg.len = len;
+    memcpy(msg.payload, payload, len);
+    return enqueue_data(&msg);
+}
+
+/**
+ * Remember the (previous hop, hop sequence number) of a frame, returns false if it was received before
+ * and only its acknowledgment got lost
+*/
+static bool data_frame_is_new(const linkaddr_t *from, uint8_t hop_seq) {
+    uint8_t i;
+    for (i = 0; i < DATA_SEEN_SIZE; i++) {
+        if (data_seen[i].hop_seq == hop_seq && linkaddr_cmp(&data_seen[i].from, from)) {
+            return false;
+        }
+    }
+    linkaddr_copy(&data_seen[data_seen_next].from, from);
+    data_seen[data_seen_next].hop_seq = hop_seq;
+    data_seen_next = (data_seen_next + 1) % DATA_SEEN_SIZE;
+    return true;
+}
+
+static void summary_input(const struct data_msg *msg);
+
+/*
+ * Callback function for the data connection
+ * Called when a data frame or its acknowledgment is received
+ */
+static void
+data_recv(struct unicast_conn *c, const linkaddr_t *from) {
+    struct data_msg *msg = packetbuf_dataptr();
+    // the length is copied into fixed size buffers, short or corrupted frames are dropped
+    if (packetbuf_datalen() < DATA_HEADER_SIZE || msg->len > DATA_PAYLOAD_SIZE || DATA_HEADER_SIZE + msg->len > packetbuf_datalen()) {
+        printf("Malformed data frame from %d.%d dropped \n", from->u8[0], from->u8[1]);
+        return;
+    }
+    estimate_link_from_packetbuf(from);
+    learn_neighbour_route(from);
+
+    if (msg->type == DATA_TYPE_ACK) {
+        struct data_frame *f;
+        for (f = list_head(data_queue); f != NULL; f = list_item_next(f))
+        {
+            if (f->in_flight && f->msg.hop_seq == msg->hop_seq && linkaddr_cmp(&f->next_addr, from)) {
+                drop_frame(f);
+                break;
+            }
+        }
+        // the window moved on, send what is waiting
+        send_queued_frames();
+        return;
+    }
+
+    uint8_t hop_seq = msg->hop_seq;
+    linkaddr_t prev_addr;
+    linkaddr_copy(&prev_addr, from);
+    bool is_new = data_frame_is_new(from, hop_seq);
+    if (is_new && msg->type == DATA_TYPE_DATA) {
+        // the frame came from its source over the previous hop, which is a route back to the source
+        msg->hops++;
+        msg->cost += link_cost(from);
+        learn_route(&msg->source_addr, from, msg->hops, msg->cost, SEQ_UNKNOWN);
+    }
+    if (is_new) {
+        if (msg->type == DATA_TYPE_AGGREGATE) {
+            // every message in the frame is delivered or batched again for its own next hop,
+            // batches sent meanwhile reuse packetbuf so the frame is unpacked from a copy
+            static struct data_msg aggregate_copy;
+            memcpy(&aggregate_copy, msg, DATA_HEADER_SIZE + msg->len);
+            unpack_aggregate(&aggregate_copy);
+        } else if (msg->type == DATA_TYPE_SUMMARY) {
+            // merged into the summary of this node, which goes on towards the sink later
+            summary_input(msg);
+        } else if (linkaddr_cmp(&msg->dest_addr, &linkaddr_node_addr)) {
+            deliver_data(&msg->source_addr, msg->payload, msg->len);
+        } else {
+            // forward towards the destination, the frame gets a new hop sequence number on the next hop
+            add_precursor(search_row(&msg->dest_addr), &prev_addr);
+            enqueue_data(msg);
+        }
+    }
+
+    // acknowledge every copy, the previous acknowledgment may have been lost
+    struct data_msg ack = {0};
+    ack.type = DATA_TYPE_ACK;
+    ack.hop_seq = hop_seq;
+    ack.len = 0;
+    packetbuf_copyfrom(&ack, DATA_HEADER_SIZE);
+    unicast_send(&data_uc, &prev_addr);
+}
+
+static const struct unicast_callbacks data_cb = {data_recv, unicast_sent};
+
+/******************************************************************************/
+/*
+ * Collection tree towards the sink
+ * The route to the sink is a normal routing table row. Its destination sequence number is the
+ * gradient round, so a new round replaces the old parent and within a round learn_route only
+ * switches to a cheaper parent. Data to the sink then takes the usual reliable data path.
+ */
+
+// sequence number of the last gradient round this node passed on
+static uint32_t gradient_seq_sent = SEQ_UNKNOWN;
+static struct ctimer gradient_timer;
+
+static void sink_address(linkaddr_t *addr) {
+    addr->u8[0] = SINK_ID;
+    addr->u8[1] = 0;
+}
+
+static bool is_sink() {
+    return linkaddr_node_addr.u8[0] == SINK_ID;
+}
+
+static void send_gradient(const struct gradient_beacon *beacon) {
+    packetbuf_copyfrom(beacon, sizeof(struct gradient_beacon));
+    printf("CTRL gradient seq %lu hops %u \n", beacon->seq, beacon->hops);
+    broadcast_send(&gradient_bc);
+}
+
+/**
+ * The gradient delay is over, advertise the route to the sink chosen in this round
+*/
+static void forward_gradient(void *ptr) {
+    linkaddr_t sink;
+    sink_address(&sink);
+    struct table_record *tr = search_row(&sink);
+    if (tr == NULL || tr->distance == UINT8_MAX) {
+        return;
+    }
+    struct gradient_beacon beacon = {tr->dest_seq, tr->distance, tr->cost};
+    gradient_seq_sent = tr->dest_seq;
+    printf("COLLECT parent %d.%d hops %u cost %u \n", tr->next_addr.u8[0], tr->next_addr.u8[1], tr->distance, tr->cost);
+    send_gradient(&beacon);
+}
+
+static void gradient_recv(struct broadcast_conn *c, const linkaddr_t *from) {
+    struct gradient_beacon beacon;
+    memcpy(&beacon, packetbuf_dataptr(), sizeof(beacon));
+    estimate_link_from_packetbuf(from);
+    if (is_sink() || is_blacklisted(from)) {
+        return;
+    }
+    learn_neighbour_route(from);
+    linkaddr_t sink;
+    sink_address(&sink);
+    learn_route(&sink, from, beacon.hops + 1, beacon.cost + link_cost(from), beacon.seq);
+    struct table_record *tr = search_row(&sink);
+    if (tr != NULL && tr->dest_seq > gradient_seq_sent && ctimer_expired(&gradient_timer)) {
+        // first beacon of a new round, pass it on once the cheapest parent is known
+        ctimer_set(&gradient_timer, random_rand() % GRADIENT_DELAY, forward_gradient, NULL);
+    }
+}
+
+static const struct broadcast_callbacks gradient_cb = {gradient_recv};
+
+/******************************************************************************/
+
+#define IP_BUF ((struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
+
+/**
+ * Nodes have the IP address 172.16.a.b, where a.b is their Rime address
+*/
+static void ip_to_linkaddr(linkaddr_t *addr, const uip_ipaddr_t *ipaddr) {
+    addr->u8[0] = ipaddr->u8[2];
+    addr->u8[1] = ipaddr->u8[3];
+}
+
+/**
+ * Start a route discovery for a destination no valid route is known to
+*/
+static void discover_route(const linkaddr_t *dest_addr) {
+    struct route_msg rreq;
+    struct table_record *table_entry = search_row(dest_addr);
+    rreq.broadcast_id = broadcast_id++;
+    rreq.distance = 1;
+    rreq.ttl = NET_DIAMETER;
+    rreq.cost = 0;
+    rreq.source_seq = seq_no;
+    // an invalid route asks for a fresher one
+    rreq.dest_seq = table_entry != NULL ? table_entry->dest_seq + 1 : SEQ_UNKNOWN;
+    rreq.is_print_only = false;
+    linkaddr_copy(&rreq.source_addr, &linkaddr_node_addr);
+    linkaddr_copy(&rreq.dest_addr, dest_addr);
+    start_discovery(&rreq);
+}
+
+/**
+ * Send the IP packet in packetbuf one hop closer to its destination. Without a valid route the packet
+ * is buffered and a route discovery started, it is sent when the RREP arrives.
+*/
+static void forward_ip(const linkaddr_t *dest_addr) {
+    struct table_record *table_entry = search_row(dest_addr);
+    if (table_entry != NULL && table_entry->distance != UINT8_MAX) {
+        unicast_send(&ip_uc, &table_entry->next_addr);
+        return;
+    }
+    struct ip_packet *p = memb_alloc(&ip_queue_mem);
+    if (p == NULL) {
+        printf("IP queue is full, packet to %d.%d dropped \n", dest_addr->u8[0], dest_addr->u8[1]);
+        return;
+    }
+    p->buf = queuebuf_new_from_packetbuf();
+    if (p->buf == NULL) {
+        memb_free(&ip_queue_mem, p);
+        printf("No queue buffer, packet to %d.%d dropped \n", dest_addr->u8[0], dest_addr->u8[1]);
+        return;
+    }
+    linkaddr_copy(&p->dest_addr, dest_addr);
+    list_add(ip_queue, p);
+    printf("IP packet to %d.%d buffered, waiting for route \n", dest_addr->u8[0], dest_addr->u8[1]);
+    discover_route(dest_addr);
+    if (search_discovery(dest_addr) == NULL) {
+        // the discovery could not be started, nothing would ever send the packet
+        drop_queued_ip(dest_addr);
+    }
+}
+
+/**
+ * Remove the buffered IP packets for a destination, sending them if a route is known now.
+ * Every packet sent overwrites packetbuf, the destination may point into it and is copied first.
+*/
+static void flush_queued_ip(const linkaddr_t *dest, bool send) {
+    linkaddr_t dest_copy;
+    const linkaddr_t *dest_addr = &dest_copy;
+    linkaddr_copy(&dest_copy, dest);
+    struct ip_packet *p = list_head(ip_queue);
+    while (p != NULL) {
+        struct ip_packet *next = list_item_next(p);
+        if (linkaddr_cmp(&p->dest_addr, dest_addr)) {
+            list_remove(ip_queue, p);
+            if (send) {
+                queuebuf_to_packetbuf(p->buf);
+                forward_ip(dest_addr);
+            } else {
+                printf("IP packet to %d.%d dropped, no route \n", dest_addr->u8[0], dest_addr->u8[1]);
+            }
+            queuebuf_free(p->buf);
+            memb_free(&ip_queue_mem, p);
+        }
+        p = next;
+    }
+}
+
+static void send_queued_ip(const linkaddr_t *dest_addr) {
+    flush_queued_ip(dest_addr, true);
+}
+
+static void drop_queued_ip(const linkaddr_t *dest_addr) {
+    flush_queued_ip(dest_addr, false);
+}
+
+/**
+ * Output function of the uIP network interface, sends the packet in uip_buf over AODV routes.
+ * Broadcasts only reach the neighbours.
+*/
+static uint8_t aodv_ip_output(void) {
+    linkaddr_t dest_addr;
+    packetbuf_copyfrom(&uip_buf[UIP_LLH_LEN], uip_len);
+    if (uip_ipaddr_cmp(&IP_BUF->destipaddr, &uip_broadcast_addr)) {
+        broadcast_send(&ip_bc);
+        return UIP_FW_OK;
+    }
+    ip_to_linkaddr(&dest_addr, &IP_BUF->destipaddr);
+    if (linkaddr_cmp(&dest_addr, &linkaddr_node_addr)) {
+        return UIP_FW_DROPPED;
+    }
+    forward_ip(&dest_addr);
+    return UIP_FW_OK;
+}
+
+static struct uip_fw_netif aodv_netif = {UIP_FW_NETIF(172,16,0,0, 255,255,0,0, aodv_ip_output)};
+
+/**
+ * Pass a received IP packet to uIP
+*/
+static void ip_input() {
+    uip_len = packetbuf_copyto(&uip_buf[UIP_LLH_LEN]);
+    tcpip_input();
+}
+
+/**
+ * Copy the IP header of the packet in packetbuf into hdr, returns false if the packet is too short for
+ * its header or for the total length the header gives, or too long for the uIP buffer.
+ * The header is copied because the data in packetbuf can sit at an odd address.
+*/
+static bool ip_header_from_packetbuf(struct uip_tcpip_hdr *hdr) {
+    uint16_t len = packetbuf_datalen();
+    if (len < UIP_IPH_LEN || len > UIP_BUFSIZE - UIP_LLH_LEN) {
+        printf("IP packet of %u bytes dropped \n", len);
+        return false;
+    }
+    memcpy(hdr, packetbuf_dataptr(), UIP_IPH_LEN);
+    uint16_t ip_len = (hdr->len[0] << 8) | hdr->len[1];
+    if (ip_len < UIP_IPH_LEN || ip_len > len) {
+        printf("IP packet with total length %u in %u bytes dropped \n", ip_len, len);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * An IP packet was received, deliver it to uIP or forward it towards its destination
+*/
+static void ip_recv(struct unicast_conn *c, const linkaddr_t *from) {
+    struct uip_tcpip_hdr hdr;
+    linkaddr_t dest_addr;
+    estimate_link_from_packetbuf(from);
+    learn_neighbour_route(from);
+    if (!ip_header_from_packetbuf(&hdr)) {
+        return;
+    }
+    ip_to_linkaddr(&dest_addr, &hdr.destipaddr);
+    if (linkaddr_cmp(&dest_addr, &linkaddr_node_addr)) {
+        ip_input();
+    } else {
+        forward_ip(&dest_addr);
+    }
+}
+
+static void ip_broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from) {
+    struct uip_tcpip_hdr hdr;
+    if (!ip_header_from_packetbuf(&hdr)) {
+        return;
+    }
+    ip_input();
+}
+
+static const struct unicast_callbacks ip_cb = {ip_recv, unicast_sent};
+static const struct broadcast_callbacks ip_bc_cb = {ip_broadcast_recv};
+
+/******************************************************************************/
+/*
+ * Sensor sampling and in-network summaries
+ * Every node reads its sensors in batches and keeps one summary per window. Summaries from the
+ * subtree are merged into it, so a node sends a single frame per window towards the sink whatever
+ * the number of nodes behind it. Deeper nodes send first, see SENSE_HOP_DELAY.
+ */
+
+/**
+ * Number of the window a global time falls into
+*/
+static uint32_t sense_window(uint32_t time) {
+    return time / ((uint32_t)SENSE_WINDOW * RTIMER_SECOND);
+}
+
+static void stats_merge(struct sensor_stats *to, const struct sensor_stats *from) {
+    if (from->count == 0) {
+        return;
+    }
+    if (to->count == 0 || from->min < to->min) {
+        to->min = from->min;
+    }
+    if (to->count == 0 || from->max > to->max) {
+        to->max = from->max;
+    }
+    to->sum += from->sum;
+    to->count += from->count;
+}
+
+static void summary_merge(struct sensor_summary *to, const struct sensor_summary *from) {
+    uint8_t i;
+    to->nodes += from->nodes;
+    for (i = 0; i < SENSOR_TYPES; i++) {
+        stats_merge(&to->stats[i], &from->stats[i]);
+    }
+}
+
+static void print_stats(const char *name, const struct sensor_stats *s) {
+    printf(" %s min %d mean %ld max %d count %u", name, s->min, s->count > 0 ? (long)(s->sum / s->count) : 0L, s->max, s->count);
+}
+
+/**
+ * Start a route discovery to the sink if there is no route and none is running, the next frame can use it
+*/
+static void discover_sink(const linkaddr_t *sink) {
+    if (!AODV_COLLECT && search_discovery(sink) == NULL) {
+        discover_route(sink);
+    }
+}
+
+/**
+ * Send a summary towards the sink, the sink logs it instead
+*/
+static void send_summary(const struct sensor_summary *summary) {
+    if (is_sink()) {
+        printf("SENSE window %lu nodes %u", summary->window, summary->nodes);
+        print_stats("light", &summary->stats[SENSOR_LIGHT]);
+        print_stats("temperature", &summary->stats[SENSOR_TEMPERATURE]);
+        printf(" \n");
+        return;
+    }
+    struct data_msg msg;
+    msg.type = DATA_TYPE_SUMMARY;
+    linkaddr_copy(&msg.source_addr, &linkaddr_node_addr);
+    sink_address(&msg.dest_addr);
+    msg.hops = 0;
+    msg.cost = 0;
+    msg.len = sizeof(struct sensor_summary);
+    memcpy(msg.payload, summary, sizeof(struct sensor_summary));
+    printf("SENSE tx window %lu nodes %u \n", summary->window, summary->nodes);
+    if (!enqueue_data(&msg)) {
+        discover_sink(&msg.dest_addr);
+    }
+}
+
+/**
+ * The subtree had its time to report, send the summary of the window
+*/
+static void summary_timeout(void *ptr) {
+    struct summary_slot *slot = ptr;
+    slot->open = false;
+    send_summary(&slot->summary);
+}
+
+/**
+ * The slot of a window, it is opened if needed. The summary is sent SENSE_HOP_DELAY per hop
+ * less than SENSE_MAX_HOPS after the end of the window.
+*/
+static struct summary_slot *summary_slot(uint32_t window) {
+    struct summary_slot *slot = &summary_slots[window % 2];
+    if (slot->open && slot->summary.window == window) {
+        return slot;
+    }
+    if (slot->open) {
+        // a window two windows ago that was never sent
+        ctimer_stop(&slot->timer);
+        summary_timeout(slot);
+    }
+    memset(&slot->summary, 0, sizeof(slot->summary));
+    slot->summary.window = window;
+    slot->open = true;
+    slot->sampled = false;
+
+    linkaddr_t sink;
+    sink_address(&sink);
+    struct table_record *tr = search_row(&sink);
+    uint8_t hops = is_sink() ? 0 : tr != NULL && tr->distance < SENSE_MAX_HOPS ? tr->distance : SENSE_MAX_HOPS;
+    uint32_t window_ticks = (uint32_t)SENSE_WINDOW * RTIMER_SECOND;
+    uint32_t left = window_ticks - timesync_global_time() % window_ticks;
+    ctimer_set(&slot->timer, (clock_time_t)((uint64_t)left * CLOCK_SECOND / RTIMER_SECOND) + (SENSE_MAX_HOPS - hops) * SENSE_HOP_DELAY, summary_timeout, slot);
+    return slot;
+}
+
+/**
+ * A summary of the subtree arrived. It is merged into the slot of its window, or passed on as it is
+ * when that window was sent already.
+*/
+static void summary_input(const struct data_msg *msg) {
+    struct sensor_summary summary;
+    if (msg->len != sizeof(summary)) {
+        return;
+    }
+    memcpy(&summary, msg->payload, sizeof(summary));
+    struct summary_slot *slot = &summary_slots[summary.window % 2];
+    if (summary.window != sense_window(timesync_global_time()) && !(slot->open && slot->summary.window == summary.window)) {
+        printf("SENSE late window %lu nodes %u from %d.%d \n", summary.window, summary.nodes, msg->source_addr.u8[0], msg->source_addr.u8[1]);
+        send_summary(&summary);
+        return;
+    }
+    summary_merge(&summary_slot(summary.window)->summary, &summary);
+}
+
+/**
+ * Read all sensors at once, they are only powered while they are read
+*/
+static void read_sensors(int16_t *values) {
+    SENSORS_ACTIVATE(light_sensor);
+    SENSORS_ACTIVATE(sht11_sensor);
+    values[SENSOR_LIGHT] = light_sensor.value(LIGHT_SENSOR_PHOTOSYNTHETIC);
+    // hundredths of a degree Celsius, -39.60 + 0.01 * raw value for the SHT11 at 3 V
+    values[SENSOR_TEMPERATURE] = sht11_sensor.value(SHT11_SENSOR_TEMP) - 3960;
+    SENSORS_DEACTIVATE(sht11_sensor);
+    SENSORS_DEACTIVATE(light_sensor);
+}
+
+/**
+ * Take a batch of readings and add it to the summary of the current window, or send it as it is
+*/
+static void sense() {
+    int16_t values[SENSOR_TYPES];
+    uint8_t i;
+    read_sensors(values);
+    if (AODV_SENSING == 2) {
+        struct sensor_reading r;
+        linkaddr_t sink;
+        r.magic = SENSE_MAGIC;
+        memcpy(r.values, values, sizeof(r.values));
+        sink_address(&sink);
+        if (is_sink()) {
+            deliver_data(&linkaddr_node_addr, (const uint8_t *)&r, sizeof(r));
+        } else if (!send_data(&sink, &r, sizeof(r), false)) {
+            discover_sink(&sink);
+        }
+        return;
+    }
+    struct summary_slot *slot = summary_slot(sense_window(timesync_global_time()));
+    if (!slot->sampled) {
+        slot->sampled = true;
+        slot->summary.nodes++;
+    }
+    for (i = 0; i < SENSOR_TYPES; i++) {
+        struct sensor_stats reading = {values[i], values[i], values[i], 1};
+        stats_merge(&slot->summary.stats[i], &reading);
+    }
+}
+
+/******************************************************************************/
+
+// header of the snapshot file, followed by count snapshot_route records
+struct snapshot_header
+{
+    uint8_t version;       // SNAPSHOT_VERSION
+    uint8_t count;         // number of routes in the file
+    uint32_t seq_no;       // sequence number of this node
+    uint32_t broadcast_id; // next broadcast id of this node
+    uint32_t generation;   // incremented for every snapshot, the newer of the two files is restored
+    uint16_t checksum;     // checksum over seq_no, all routes and generation, detects changes and torn writes
+};
+
+// a valid route as stored in the snapshot file, alternates are not kept
+struct snapshot_route
+{
+    linkaddr_t dest_addr;
+    linkaddr_t next_addr;
+    uint8_t distance;
+    uint16_t cost;
+    uint32_t dest_seq;
+};
+
+#define SNAPSHOT_MAX_SIZE (sizeof(struct snapshot_header) + TABLE_SIZE * sizeof(struct snapshot_route))
+
+// checksum of the routes and broadcast id of the snapshot on flash, a new one is only written if they are outdated
+static uint16_t snapshot_checksum;
+static uint32_t snapshot_broadcast_id;
+
+// the snapshot files, the next snapshot goes to the one that does not hold the newest complete snapshot
+static const char *const snapshot_files[2] = {SNAPSHOT_FILE_A, SNAPSHOT_FILE_B};
+static uint8_t snapshot_next_file;
+static uint32_t snapshot_generation;
+
+// expires the restored routes no routing traffic confirmed
+static struct ctimer restore_timer;
+
+static uint16_t checksum_add(uint16_t sum, const void *data, uint8_t len) {
+    const uint8_t *p = data;
+    while (len-- > 0) {
+        sum = ((sum << 1) | (sum >> 15)) + *p++;
+    }
+    return sum;
+}
+
+static void snapshot_route_from_row(struct snapshot_route *r, const struct table_record *tr) {
+    // the padding is covered by the checksum as well, it must not hold stack garbage
+    memset(r, 0, sizeof(*r));
+    linkaddr_copy(&r->dest_addr, &tr->dest_addr);
+    linkaddr_copy(&r->next_addr, &tr->next_addr);
+    r->distance = tr->distance;
+    r->cost = tr->cost;
+    r->dest_seq = tr->dest_seq;
+}
+
+/**
+ * Only routes with a finite distance are worth keeping, reverse pointers of a running discovery included
+*/
+static bool is_snapshot_route(const struct table_record *tr) {
+    return tr->distance != UINT8_MAX;
+}
+
+/**
+ * Write the valid routes and the counters of this node to flash.
+ * To save flash wear nothing is written unless the routes or the sequence number changed, or the
+ * broadcast id used up half of the ids skipped on restart. The snapshot replaces the older of the two
+ * files, so a reset while it is written leaves the previous snapshot intact. That file is removed and
+ * reserved at full size, so Coffee writes it to fresh pages instead of merging a modification log.
+*/
+static void take_snapshot() {
+    struct snapshot_header header;
+    struct snapshot_route r;
+    struct table_record *tr;
+
+    memset(&header, 0, sizeof(header));
+    header.version = SNAPSHOT_VERSION;
+    header.count = 0;
+    header.seq_no = seq_no;
+    header.broadcast_id = broadcast_id;
+    uint16_t checksum = checksum_add(0, &seq_no, sizeof(seq_no));
+    for (tr = list_head(routing_table); tr != NULL; tr = list_item_next(tr))
+    {
+        if (is_snapshot_route(tr)) {
+            snapshot_route_from_row(&r, tr);
+            checksum = checksum_add(checksum, &r, sizeof(r));
+            header.count++;
+        }
+    }
+    if (checksum == snapshot_checksum && broadcast_id - snapshot_broadcast_id < BROADCAST_ID_RESERVE / 2) {
+        return;
+    }
+    header.generation = snapshot_generation + 1;
+    header.checksum = checksum_add(checksum, &header.generation, sizeof(header.generation));
+
+    const char *name = snapshot_files[snapshot_next_file];
+    cfs_remove(name);
+    cfs_coffee_reserve(name, SNAPSHOT_MAX_SIZE);
+    int fd = cfs_open(name, CFS_WRITE);
+    if (fd < 0) {
+        printf("Routing table snapshot could not be opened \n");
+        return;
+    }
+    bool ok = cfs_write(fd, &header, sizeof(header)) == sizeof(header);
+    for (tr = list_head(routing_table); ok && tr != NULL; tr = list_item_next(tr))
+    {
+        if (is_snapshot_route(tr)) {
+            snapshot_route_from_row(&r, tr);
+            ok = cfs_write(fd, &r, sizeof(r)) == sizeof(r);
+        }
+    }
+    cfs_close(fd);
+    if (!ok) {
+        printf("Routing table snapshot could not be written \n");
+        return;
+    }
+    snapshot_checksum = checksum;
+    snapshot_broadcast_id = broadcast_id;
+    snapshot_generation = header.generation;
+    snapshot_next_file ^= 1;
+    printf("Routing table snapshot %lu written, %u routes \n", header.generation, header.count);
+}
+
+/**
+ * The restored routes that were not confirmed in time may be stale, they become invalid so the next
+ * use starts a route discovery with a fresher sequence number
+*/
+static void expire_restored_routes(void *ptr) {
+    struct table_record *tr;
+    for (tr = list_head(routing_table); tr != NULL; tr = list_item_next(tr))
+    {
+        if (tr->restored) {
+            tr->restored = false;
+            tr->distance = UINT8_MAX;
+            printf("Restored route to %d.%d expired \n", tr->dest_addr.u8[0], tr->dest_addr.u8[1]);
+        }
+    }
+}
+
+/**
+ * Read the header of a snapshot file and check its routes against the checksum.
+ * Returns false if the file is missing, of another version, or its write was interrupted.
+*/
+static bool snapshot_is_valid(const char *name, struct snapshot_header *header) {
+    struct snapshot_route r;
+    uint8_t i;
+
+    int fd = cfs_open(name, CFS_READ);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = cfs_read(fd, header, sizeof(*header)) == sizeof(*header) && header->version == SNAPSHOT_VERSION && header->count <= TABLE_SIZE;
+    uint16_t checksum = checksum_add(0, &header->seq_no, sizeof(header->seq_no));
+    for (i = 0; ok && i < header->count; i++)
+    {
+        ok = cfs_read(fd, &r, sizeof(r)) == sizeof(r);
+        checksum = checksum_add(checksum, &r, sizeof(r));
+    }
+    cfs_close(fd);
+    return ok && checksum_add(checksum, &header->generation, sizeof(header->generation)) == header->checksum;
+}
+
+/**
+ * Load the routes and counters of the newest complete snapshot into the empty routing table.
+ * The sequence number and broadcast id continue after the ones used before the reboot, so neighbours
+ * do not take new routing messages of this node for old ones.
+*/
+static void restore_snapshot() {
+    struct snapshot_header header, other;
+    struct snapshot_route r;
+    uint8_t file, i;
+
+    bool valid_a = snapshot_is_valid(snapshot_files[0], &header);
+    bool valid_b = snapshot_is_valid(snapshot_files[1], &other);
+    if (valid_a && (!valid_b || (int32_t)(header.generation - other.generation) > 0)) {
+        file = 0;
+    } else if (valid_b) {
+        file = 1;
+        header = other;
+    } else {
+        printf("No complete routing table snapshot, cold start \n");
+        return;
+    }
+    // the next snapshot must not overwrite this one
+    snapshot_generation = header.generation;
+    snapshot_next_file = file ^ 1;
+
+    int fd = cfs_open(snapshot_files[file], CFS_READ);
+    if (fd < 0 || cfs_seek(fd, sizeof(header), CFS_SEEK_SET) != sizeof(header)) {
+        if (fd >= 0) {
+            cfs_close(fd);
+        }
+        printf("Routing table snapshot could not be read, cold start \n");
+        return;
+    }
+    for (i = 0; i < header.count; i++)
+    {
+        if (cfs_read(fd, &r, sizeof(r)) != sizeof(r)) {
+            break;
+        }
+        struct table_record *tr = memb_alloc(&routing_table_mem);
+        if (tr == NULL) {
+            break;
+        }
+        // no alternates or precursors survive the reboot
+        memset(tr, 0, sizeof(*tr));
+        linkaddr_copy(&tr->dest_addr, &r.dest_addr);
+        linkaddr_copy(&tr->next_addr, &r.next_addr);
+        tr->distance = r.distance;
+        tr->cost = r.cost;
+        tr->dest_seq = r.dest_seq;
+        tr->restored = true;
+        list_add(routing_table, tr);
+    }
+    cfs_close(fd);
+    if (i < header.count) {
+        // the file was checked before, but none of its routes can be trusted if it cannot be read again
+        list_init(routing_table);
+        memb_init(&routing_table_mem);
+        printf("Routing table snapshot is incomplete, cold start \n");
+        return;
     }
+
+    seq_no = header.seq_no + 1;
+    if (AODV_COLLECT) {
+        // the sink used a sequence number for every gradient round since the snapshot was taken
+        seq_no += SNAPSHOT_INTERVAL / GRADIENT_INTERVAL + 1;
+    }
+    broadcast_id = header.broadcast_id + BROADCAST_ID_RESERVE;
+    if (header.count > 0) {
+        ctimer_set(&restore_timer, CLOCK_SECOND * RESTORED_ROUTE_LIFETIME, expire_restored_routes, NULL);
+    }
+    printf("Warm restart with %u routes from snapshot %lu, seq no %lu \n", header.count, header.generation, seq_no);
+    print_routing_table();
 }
 
+/******************************************************************************/
+
+static uint8_t traffic_mode = TRAFFIC_MODE;
+static clock_time_t traffic_interval = (uint32_t)TRAFFIC_INTERVAL * CLOCK_SECOND / 1000;
+static uint8_t traffic_dests[TRAFFIC_MAX_DESTINATIONS] = {TRAFFIC_DESTINATIONS};
+static uint8_t traffic_dest_count;
+static uint16_t traffic_warmup = TRAFFIC_WARMUP;
+static uint16_t traffic_duration = TRAFFIC_DURATION;
+
+static uint8_t traffic_phase = TRAFFIC_PHASE_IDLE;
+static uint16_t traffic_seq;
+static struct etimer traffic_send_timer, traffic_phase_timer;
+
 /**
- * Print a message
+ * Time to the next packet, exponentially distributed with the given mean.
+ * -ln(u) is computed from an integer log2 of a random u, interpolated linearly between powers of two.
 */
-static void print_message(struct route_msg msg)
-{
-    printf("message: source address: %d.%d, source seq: %lu, broadcast id: %lu, dest address: %d.%d, dest seq: %lu, hop count: %u \n",
-           msg.source_addr.u8[0], msg.source_addr.u8[1], msg.source_seq, msg.broadcast_id, msg.dest_addr.u8[0], msg.dest_addr.u8[1], msg.dest_seq, msg.distance);
+static clock_time_t exponential_interval(clock_time_t mean) {
+    uint16_t u = random_rand() | 1;
+    uint8_t msb = 15;
+    while (!(u & (1u << msb))) {
+        msb--;
+    }
+    // log2(u / 65536) and -ln(u / 65536) in 1/256 units, ln(2) is about 177/256
+    uint32_t log2_u = ((uint32_t)msb << 8) + (((uint32_t)(u - (1u << msb)) << 8) >> msb);
+    uint32_t neg_ln = ((16UL << 8) - log2_u) * 177 / 256;
+    return (uint32_t)mean * neg_ln >> 8;
 }
 
-/**
- * Send a unicast message
- */
-static void send_unicast_msg(struct route_msg msg, linkaddr_t dest, struct table_record *table_entry) {
-    /* Copy data to the packet buffer */
-    packetbuf_copyfrom(&msg, sizeof(struct route_msg));
-    unicast_send(&uc, &dest);
-    free(table_entry);
-    table_entry = NULL;  
+static void traffic_schedule() {
+    clock_time_t interval = traffic_mode == TRAFFIC_POISSON ? exponential_interval(traffic_interval) : traffic_interval;
+    etimer_set(&traffic_send_timer, interval > 0 ? interval : 1);
 }
 
-// Start broadcasting a message from source node
-static void start_broadcast(struct route_msg msg) {
-    /* Copy data to the packet buffer */
-    packetbuf_copyfrom(&msg, sizeof(struct route_msg));
-    /* Send broadcast packet RREQ */
-    broadcast_send(&broadcast);
+/**
+ * Pick the destination of the next packet, one of the configured ones or a random peer
+*/
+static void traffic_destination(linkaddr_t *dest_addr) {
+    if (AODV_COLLECT) {
+        sink_address(dest_addr);
+        return;
+    }
+    dest_addr->u8[1] = 0;
+    if (traffic_dest_count > 0) {
+        dest_addr->u8[0] = traffic_dests[random_rand() % traffic_dest_count];
+        return;
+    }
+    do {
+        dest_addr->u8[0] = 1 + random_rand() % TRAFFIC_NODES;
+    } while (linkaddr_cmp(dest_addr, &linkaddr_node_addr) && TRAFFIC_NODES > 1);
 }
 
-/*************************************************************************/
-/* 
- * Callback function for broadcast
- * Called when a packet has been received by the broadcast module
- */
-static void
-recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from) {
-	struct route_msg msg;
-	msg = *((struct route_msg *)packetbuf_dataptr());
-    // if it is a source node and it received request from its neighbours, discard it
-    if (linkaddr_cmp(&msg.source_addr, &linkaddr_node_addr)) {
+static void traffic_send() {
+    struct traffic_msg t;
+    linkaddr_t dest_addr;
+    traffic_destination(&dest_addr);
+    if (linkaddr_cmp(&dest_addr, &linkaddr_node_addr)) {
         return;
     }
+    t.magic = TRAFFIC_MAGIC;
+    t.phase = traffic_phase;
+    t.seq = traffic_seq++;
+    t.timestamp = timesync_global_time();
+    t.level = timesync_level < TIMESYNC_TRAFFIC_MAX_LEVEL ? timesync_level : TIMESYNC_TRAFFIC_MAX_LEVEL;
+    struct table_record *table_entry = search_row(&dest_addr);
+    uint8_t hops = table_entry != NULL && table_entry->distance != UINT8_MAX ? table_entry->distance : 0;
+    bool sent = send_data(&dest_addr, &t, sizeof(t), true);
+    printf("TRAFFIC tx dest %d.%d seq %u phase %u sent %lu hops %u %s \n", dest_addr.u8[0], dest_addr.u8[1], t.seq, t.phase, t.timestamp, hops, sent ? "ok" : "drop");
+    if (!sent && !AODV_COLLECT && search_discovery(&dest_addr) == NULL) {
+        // the packet is lost, but the next ones may find a route
+        discover_route(&dest_addr);
+    }
+}
 
-    struct table_record filter;
-    struct table_record *table_entry = NULL;
-    // check if same request is received again, discard it.
-    // the source address and broadcast id uniquely identifies a request
-    // prepare filter to search in table
-    linkaddr_copy((linkaddr_t *)&filter.dest_addr, &msg.source_addr);
-    table_entry = search_row(filter);
-    if (table_entry != NULL && table_entry->broadcast_id == msg.broadcast_id) {
-        // its a duplicate request, discard it
-        free(table_entry);
-        table_entry = NULL;
+/**
+ * Start with the warm-up phase, both timers belong to pt_traffic
+*/
+static void traffic_start() {
+    if (traffic_mode == TRAFFIC_OFF) {
         return;
     }
+    traffic_phase = TRAFFIC_PHASE_WARMUP;
+    traffic_seq = 0;
+    printf("TRAFFIC start mode %u interval %u warmup %u duration %u \n", traffic_mode, traffic_interval, traffic_warmup, traffic_duration);
+    etimer_set(&traffic_phase_timer, CLOCK_SECOND * traffic_warmup);
+    traffic_schedule();
+}
 
-    // print the received message details
-	printf("broadcast message received from %d.%d: \n", from->u8[0], from->u8[1]);
-    print_message(msg);
-    bool is_destination = false; // true if this is the destination node
-    // check if current node is the destination node
-    if (linkaddr_cmp(&msg.dest_addr, &linkaddr_node_addr)) {
-        is_destination = true;
-        // this is the destination node, prepare a route reply RREP
-        // create a new entry in routing table
-        insert_row(msg, from);
-        // printing routing table
-        print_routing_table();
-
-        // prepare RREP (route reply)
-        // the source becomes destination
-        linkaddr_copy((linkaddr_t *)&msg.dest_addr, &msg.source_addr);
-        // the destination becomes source
-        linkaddr_copy((linkaddr_t *)&msg.source_addr, &linkaddr_node_addr);
-        msg.distance = 1;
-        printf("Message has received its destination. \n");
+static void traffic_stop() {
+    etimer_stop(&traffic_send_timer);
+    etimer_stop(&traffic_phase_timer);
+    if (traffic_phase != TRAFFIC_PHASE_IDLE) {
+        printf("TRAFFIC stop generated %u \n", traffic_seq);
     }
-    // check if route to destination exist in routing table, otherwise re-broadcast
-    // prepare search filter, find by destination address
-    linkaddr_copy((linkaddr_t *)&filter.dest_addr, &msg.dest_addr);
-    table_entry = search_row(filter);
-    linkaddr_t next_addr;
+    traffic_phase = TRAFFIC_PHASE_IDLE;
+}
 
-    // an intermediate node can only reply on behalf of destination if destination
-    // sequence number in route table is grater than or equal to the one which is in REQUEST
-    if (table_entry != NULL && ((table_entry->dest_seq >= msg.dest_seq) || is_destination ) && table_entry->distance != UINT8_MAX) {
-        // record found in routing table
-        printf("record found in table for destination %d.%d. Now sending RREP \n", table_entry->dest_addr.u8[0], table_entry->dest_addr.u8[1]);
-        if (!linkaddr_cmp(&msg.dest_addr, &linkaddr_node_addr) && !linkaddr_cmp(&msg.source_addr, &linkaddr_node_addr)) {
-            // This is not destination nor source node
-            // create a new entry in routing table
-            insert_row(msg, from);
-            print_routing_table();
-            // The route to destination is found on this is an intermediate node, send RREP
-            msg.dest_seq = table_entry->dest_seq;
-            msg.distance = table_entry->distance + 1;
-            // the source becomes destination
-            linkaddr_copy((linkaddr_t *)&msg.dest_addr, &msg.source_addr);
-            // the destination becomes source
-            linkaddr_copy((linkaddr_t *)&msg.source_addr, &table_entry->dest_addr);
-            linkaddr_copy((linkaddr_t *)&next_addr, from);
-        } else {
-            // this is the destination node
-            uint8_t temp_dest_seq = msg.source_seq;
-            if (msg.dest_seq > seq_no) {
-                msg.source_seq = msg.dest_seq;
-            } else {
-                msg.source_seq = seq_no;
-            }
-            msg.dest_seq = temp_dest_seq;
-            msg.distance = 1;
-            linkaddr_copy((linkaddr_t *)&next_addr, &table_entry->next_addr);
+static void traffic_next_phase() {
+    if (traffic_phase == TRAFFIC_PHASE_WARMUP) {
+        traffic_phase = TRAFFIC_PHASE_MEASURE;
+        printf("TRAFFIC measure seq %u \n", traffic_seq);
+        if (traffic_duration > 0) {
+            etimer_set(&traffic_phase_timer, CLOCK_SECOND * traffic_duration);
         }
-        
-        // start uni casting from here
-        // send unicast message
-        send_unicast_msg(msg, next_addr, table_entry);
-        // seq_no++;
     } else {
-        // route to destination not found in routing table, re-broadcast and insert in routing table
-        insert_row(msg, from);
-        // printing routing table
-        print_routing_table();
-        // re-broadcasting
-        msg.distance++;
-        packetbuf_copyfrom(&msg, sizeof(struct route_msg));
-        printf("Broadcasting again \n");
-        /* Send broadcast packet RREQ */
-        broadcast_send(&broadcast);
-        process_start(&pt_delete_reverse_pointer, (linkaddr_t *)&msg.source_addr);
+        traffic_stop();
     }
 }
 
-static const struct broadcast_callbacks broadcast_callbacks = {recv_broadcast};
-
-/*************************************************************************/
-/* 
- * Callback function for unicast
- * Called when a packet has been received by the broadcast module
- */
-static void
-unicast_recv(struct unicast_conn *c, const linkaddr_t *from) {
-    char *ackk = packetbuf_dataptr();
-    // if the acknowledgment is received from neighbour node, exit the timer process
-    // we no longer need to send RERR because our immediate neighbour towards the destination
-    // replied back, which means the link is not broken.
-    if (strcmp(ackk, "ack") == 0 && etimer_pending()) {
-        // expire the timer
-        // etimer_stop(&et);
-        process_exit(&pt_timer);
-        return;
-    }
-    
-    // struct route_msg msg;
-    struct route_msg msg;
-    msg = *((struct route_msg *)packetbuf_dataptr());
-    
-    // prepare search filter,  and search route to destination address in routing table
-    struct table_record filter;
-    struct table_record *table_entry = NULL;
-    linkaddr_copy((linkaddr_t *)&filter.dest_addr, &msg.dest_addr);
-    table_entry = search_row(filter);
-
-    if (msg.is_print_only == true) {
-        // this request is only for printing route to destination
-        // every node till destination just prints its address
-        printf("%d.%d \n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
-        if (table_entry != NULL) {
-            msg.distance++;
-            if (!linkaddr_cmp(&table_entry->next_addr, from)) {
-                // send unicast message
-                send_unicast_msg(msg, table_entry->next_addr, table_entry);
-            }
-            // initiate the timer process
-            process_start(&pt_timer, (struct route_msg*)&msg);
-        } 
-        // sending an acknowledgment back to previous neighbour
-        packetbuf_copyfrom("ack", 3);
-        unicast_send(&uc, from);
-        return;
-    } else if (msg.distance == UINT8_MAX) {
-        // this is a RERR, set hop count to infinity
-        struct table_record filter1;
-        struct table_record *table_entry1 = NULL;
-        linkaddr_copy((linkaddr_t *)&filter1.dest_addr, &msg.source_addr);
-        table_entry1 = search_row(filter1);   
-        if (table_entry1 != NULL) {
-            table_entry1->distance = UINT8_MAX;
-            free(table_entry1);
-            print_routing_table();
-            if (linkaddr_cmp(&msg.dest_addr, &linkaddr_node_addr)) {
-                // if current node is the actual source node which initiated request
-                return;
-            } else {
-                // send unicast message i.e propagate RERR backwards
-                printf("Propagating RERR backwards to %d.%d ", table_entry->next_addr.u8[0], table_entry->next_addr.u8[1]);
-                send_unicast_msg(msg, table_entry->next_addr, table_entry);
-                return;
-            }
+static bool is_traffic_source() {
+    static const uint8_t sources[] = {TRAFFIC_SOURCES};
+    uint8_t i;
+    for (i = 0; i < sizeof(sources); i++) {
+        if (sources[i] != 0 && sources[i] == linkaddr_node_addr.u8[0]) {
+            return true;
         }
     }
-    
-    // unicast message is received which means this node is on the path of RREP
-    // we need to exit the timer process which deletes reverse pointer entries
-    if (etimer_pending()) {
-        process_exit(&pt_delete_reverse_pointer);
-    }
-
-    printf("unicast message received from %d.%d:\n",
-           from->u8[0], from->u8[1]);
-    print_message(msg);
+    return false;
+}
 
-    // check if current node is the destintation node for RREP (i.e the source which initiated RREQ)
-    if (linkaddr_cmp(&msg.dest_addr, &linkaddr_node_addr)) {
-        // this is the destination node
-        printf("Source node received acknowledgment -------------------------------------- \n");
-        // this may be a re-acknowledgment due to a better route found. update the route information if required
-        // Or if this route is not saved, save it in routing table.
-        upsert_route_for_REP(msg, from);
-        print_routing_table();
+/**
+ * Serial commands of the traffic generator:
+ * traffic start | stop | cbr <ms> | poisson <ms> | dest [id ...] | phases <warmup s> <duration s>
+*/
+static void traffic_command(const char *line) {
+    if (strncmp(line, "traffic ", 8) != 0) {
         return;
     }
-
-    // check if route to destination exist in routing table
-    if (table_entry != NULL) {
-        // record found in routing table i.e this node has route to destination.
-        printf("record found in table for destination %d.%d \n", table_entry->dest_addr.u8[0], table_entry->dest_addr.u8[1]);
-        // send RREP on behalf of destination only if destination sequence number in
-        // routing table >= destination sequence number in request.
-        if (table_entry->dest_seq >= msg.dest_seq) {
-            if (!upsert_route_for_REP(msg, from)) {
-                return;
+    const char *arg = line + 8;
+    char *end;
+    if (strcmp(arg, "start") == 0) {
+        traffic_stop();
+        traffic_start();
+    } else if (strcmp(arg, "stop") == 0) {
+        traffic_stop();
+    } else if (strncmp(arg, "cbr ", 4) == 0 || strncmp(arg, "poisson ", 8) == 0) {
+        traffic_mode = arg[0] == 'c' ? TRAFFIC_CBR : TRAFFIC_POISSON;
+        traffic_interval = strtoul(strchr(arg, ' ') + 1, NULL, 10) * CLOCK_SECOND / 1000;
+    } else if (strncmp(arg, "dest", 4) == 0) {
+        traffic_dest_count = 0;
+        arg += 4;
+        while (traffic_dest_count < TRAFFIC_MAX_DESTINATIONS) {
+            uint8_t id = strtoul(arg, &end, 10);
+            if (end == arg) {
+                break;
             }
-            print_routing_table();
-            // start uni casting from here
-            msg.distance++;
-            // send unicast message
-            send_unicast_msg(msg, table_entry->next_addr, table_entry);
-        } else {
-            // the route is outdated
+            traffic_dests[traffic_dest_count++] = id;
+            arg = end;
         }
+    } else if (strncmp(arg, "phases ", 7) == 0) {
+        traffic_warmup = strtoul(arg + 7, &end, 10);
+        traffic_duration = strtoul(end, NULL, 10);
+    } else {
+        printf("Unknown traffic command: %s \n", arg);
+        return;
     }
+    printf("TRAFFIC config mode %u interval %u destinations %u warmup %u duration %u \n", traffic_mode, traffic_interval, traffic_dest_count, traffic_warmup, traffic_duration);
 }
 
-static const struct unicast_callbacks unicast_cb = {unicast_recv};
 
 /******************************************************************************/
 
@@ -420,27 +3278,67 @@ PROCESS_THREAD(pt_source, ev, data)
     broadcast_open(&broadcast, 130, &broadcast_callbacks);
     // Set up a unicast connection at channel 146
     unicast_open(&uc, 146, &unicast_cb);
+    // the RREPs at channel 151, received like the other route messages
+    unicast_open(&rrep_uc, 151, &unicast_cb);
+    // Set up the reliable data connection at channel 147
+    unicast_open(&data_uc, 147, &data_cb);
+    // Route IP packets over AODV at channels 148 and 149
+    unicast_open(&ip_uc, 148, &ip_cb);
+    broadcast_open(&ip_bc, 149, &ip_bc_cb);
+    uip_fw_default(&aodv_netif);
 
     SENSORS_ACTIVATE(button_sensor);
 
     // initialize the routing table
     list_init(routing_table);
     memb_init(&routing_table_mem);
+    list_init(neighbour_table);
+    memb_init(&neighbour_table_mem);
+    list_init(discovery_list);
+    memb_init(&discovery_mem);
+    list_init(data_queue);
+    memb_init(&data_queue_mem);
+    list_init(data_repair_list);
+    memb_init(&data_repair_mem);
+    list_init(aggregate_list);
+    memb_init(&aggregate_mem);
+    list_init(ip_queue);
+    memb_init(&ip_queue_mem);
+
+    // warm restart from the routes known before the reboot
+    restore_snapshot();
+    process_start(&pt_snapshot, NULL);
+    process_start(&pt_traffic, NULL);
+    process_start(&pt_energy, NULL);
+    // Time beacons at channel 131
+    broadcast_open(&timesync_bc, 131, &timesync_cb);
+    process_start(&pt_timesync, NULL);
+    // Gradient beacons of the collection tree at channel 132
+    broadcast_open(&gradient_bc, 132, &gradient_cb);
+    // RERRs at channels 133 (broadcast) and 150 (unicast)
+    broadcast_open(&rerr_bc, 133, &rerr_bc_cb);
+    unicast_open(&rerr_uc, 150, &rerr_uc_cb);
+    if (AODV_COLLECT) {
+        process_start(&pt_gradient, NULL);
+    }
+    if (AODV_SENSING) {
+        process_start(&pt_sense, NULL);
+    }
+    // Hellos of the cluster election at channel 134
+    broadcast_open(&cluster_bc, 134, &cluster_cb);
+    if (AODV_CLUSTER) {
+        process_start(&pt_cluster, NULL);
+    }
 
     while (1)
     {
         // wait for user button press
         PROCESS_WAIT_EVENT_UNTIL(ev == sensors_event && data == &button_sensor);
-        // Set address of the destination node (8.0)
+        // Set address of the destination node (the sink)
         linkaddr_t addr;
-        addr.u8[0] = 8;
-        addr.u8[1] = 0;
+        sink_address(&addr);
         // first check in routing table if the route to destination is available
-        struct table_record filter;
-        struct table_record *table_entry = NULL;
-        // prepare filter to search in table
-        linkaddr_copy((linkaddr_t *)&filter.dest_addr, &addr);
-        table_entry = search_row(filter);
+        struct table_record *table_entry = search_row(&addr);
         // if this is not the destination node itself
         if (!linkaddr_cmp(&addr, &linkaddr_node_addr))
         {
@@ -448,6 +3346,8 @@ PROCESS_THREAD(pt_source, ev, data)
             struct route_msg msg;
             msg.broadcast_id = broadcast_id;
             msg.distance = 1;
+            msg.ttl = NET_DIAMETER;
+            msg.cost = 0;
             msg.source_seq = seq_no;
             msg.dest_seq = 0; // the destination seq number is unknown initially
             msg.is_print_only = false;
@@ -455,15 +3355,20 @@ PROCESS_THREAD(pt_source, ev, data)
             linkaddr_copy((linkaddr_t *)&msg.source_addr, &linkaddr_node_addr);
             // copy destination address
             linkaddr_copy((linkaddr_t *)&msg.dest_addr, &addr);
-            if (table_entry == NULL)
+            if (AODV_COLLECT && (table_entry == NULL || table_entry->distance == UINT8_MAX))
             {
-                start_broadcast(msg);
+                // the route to the sink comes with the next gradient round
+                printf("No parent towards the sink yet \n");
+            }
+            else if (table_entry == NULL)
+            {
+                start_discovery(&msg);
             }
             else if (table_entry->distance == UINT8_MAX)
             {
                 // hop count is infinity, do the broadcast after incrementing the sequence number
                 msg.dest_seq = table_entry->dest_seq + 1;
-                start_broadcast(msg);
+                start_discovery(&msg);
             }
             else
             {
@@ -477,10 +3382,16 @@ PROCESS_THREAD(pt_source, ev, data)
                 msg.is_print_only = true; // if true, its just a route printing request, not a route discovery
                 // every node till destination just prints its address
                 printf("%d.%d \n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
-                /* Copy data to the packet buffer */
-                packetbuf_copyfrom(&msg, sizeof(struct route_msg));
-                unicast_send(&uc, &table_entry->next_addr);
+                send_unicast_msg(&msg, &table_entry->next_addr);
                 process_start(&pt_timer, (struct route_msg*)&msg);
+
+                // send a burst of reliable data frames, several of them are in flight at the same time
+                static uint8_t data_counter = 0;
+                uint8_t i;
+                for (i = 0; i < DATA_BURST_SIZE; i++) {
+                    data_counter++;
+                    send_data(&addr, &data_counter, sizeof(data_counter), true);
+                }
             }
         }
         broadcast_id++;
@@ -493,48 +3404,91 @@ static struct route_msg msg_global;
 
 /**
  * On timeout perform RERR . Set hop count to infinity and propagate this message back to actual source node 
+ * If the destination is close, first try a local repair with a small RREQ from this node, the message
+ * waiting for the acknowledgment is kept in msg_global and sent again over the repaired route.
 */
 PROCESS_THREAD(pt_timer, ev, data)
 {
 	PROCESS_BEGIN();
     // 3 seconds are enough to wait for acknowledgment from immediate neighbour
 	msg_global = *((struct route_msg *)data);
-    etimer_set(&et1, CLOCK_SECOND * 4);
-    PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et1));
-    
-    // set the hope count to infinity (i.e UINT8_MAX) in current node first 
-    struct table_record filter1;
-    linkaddr_copy((linkaddr_t *)&filter1.dest_addr, &msg_global.dest_addr);
-    struct table_record *table_entry1 = search_row(filter1);
-    if (table_entry1 != NULL) {
+    static bool repair_attempted;
+    // next hop of the broken link, and the precursors held back during the local repair
+    static linkaddr_t broken_addr;
+    static linkaddr_t repair_precursors[MAX_PRECURSORS];
+    static uint8_t repair_precursor_count;
+    repair_attempted = false;
+    while (1) {
+        etimer_set(&et1, CLOCK_SECOND * 4);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et1));
+
+        struct table_record *table_entry1 = search_row(&msg_global.dest_addr);
+        if (table_entry1 == NULL) {
+            break;
+        }
         printf("Error detected. Reply not received within timout from node %d.%d.\n", table_entry1->next_addr.u8[0], table_entry1->next_addr.u8[1]);
-        printf("Setting hop count to infinity for this and previous nodes \n");
-        table_entry1->distance = UINT8_MAX;
-        free(table_entry1);
-    }
-    
-    // Now send RERR to source node i.e informing about the error so that all nodes
-    // till source node set the hop count to infinity
-
-    linkaddr_t temp_addr;
-    linkaddr_copy((linkaddr_t *)&temp_addr, &msg_global.dest_addr);
-    // the source becomes destination and destination becomes soruce (For sending RERR)
-    linkaddr_copy((linkaddr_t *)&msg_global.dest_addr, &msg_global.source_addr);
-    linkaddr_copy((linkaddr_t *)&msg_global.source_addr, &temp_addr);
-
-    msg_global.distance = UINT8_MAX;
-
-    struct table_record filter;
-    linkaddr_copy((linkaddr_t *)&filter.dest_addr, &msg_global.dest_addr);
-    struct table_record *table_entry = search_row(filter);
-    if (table_entry != NULL && !linkaddr_cmp(&table_entry->next_addr, &linkaddr_node_addr)) {
-        // list_remove(routing_table, table_entry);
+        // the link is broken, no route may use it any more
+        linkaddr_copy(&broken_addr, &table_entry1->next_addr);
+        update_link_estimate(&broken_addr, ETX_MAX);
+        remove_broken_next_hop(&broken_addr);
+        uint8_t old_distance = table_entry1->distance;
+        bool repair = false;
+        if (!switch_to_alternate(table_entry1)) {
+            // set the hope count to infinity (i.e UINT8_MAX) in current node first
+            table_entry1->distance = UINT8_MAX;
+            repair = !repair_attempted && old_distance <= MAX_REPAIR_DISTANCE && !linkaddr_cmp(&msg_global.source_addr, &linkaddr_node_addr);
+            if (repair) {
+                // the precursors are only told about this destination if the local repair fails
+                repair_precursor_count = table_entry1->precursor_count;
+                memcpy(repair_precursors, table_entry1->precursors, sizeof(repair_precursors));
+                table_entry1->precursor_count = 0;
+            }
+        }
+        // the other routes over the broken link and this one if it cannot be repaired go into one RERR
+        link_broken(&broken_addr);
+        if (table_entry1->distance == UINT8_MAX) {
+            if (!repair) {
+                printf("Setting hop count to infinity for this and previous nodes \n");
+                break;
+            }
+            // the destination is close, search a new route from here with a small RREQ
+            printf("Starting local repair for destination %d.%d \n", msg_global.dest_addr.u8[0], msg_global.dest_addr.u8[1]);
+            repair_attempted = true;
+            struct route_msg rreq;
+            linkaddr_copy(&rreq.source_addr, &linkaddr_node_addr);
+            linkaddr_copy(&rreq.dest_addr, &msg_global.dest_addr);
+            rreq.source_seq = seq_no;
+            rreq.broadcast_id = broadcast_id++;
+            rreq.dest_seq = table_entry1->dest_seq + 1;
+            rreq.distance = 1;
+            rreq.ttl = old_distance + LOCAL_ADD_TTL;
+            rreq.cost = 0;
+            rreq.is_print_only = false;
+            // the RREQ rate limit may refuse it, then there is nothing to wait for
+            bool repair_sent = start_broadcast(&rreq);
+
+            if (repair_sent) {
+                etimer_set(&et1, CLOCK_SECOND * LOCAL_REPAIR_TIMEOUT);
+                PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et1) || ev == PROCESS_EVENT_POLL);
+            }
+            // local variables do not survive the wait, search the route again
+            table_entry1 = search_row(&msg_global.dest_addr);
+            if (table_entry1 != NULL) {
+                uint8_t i;
+                for (i = 0; i < repair_precursor_count; i++) {
+                    add_precursor(table_entry1, &repair_precursors[i]);
+                }
+            }
+            if (table_entry1 == NULL || table_entry1->distance == UINT8_MAX) {
+                printf("Local repair failed. Setting hop count to infinity for this and previous nodes \n");
+                send_rerr();
+                break;
+            }
+            printf("Local repair succeeded \n");
+        }
+        // resend over the alternate next hop and wait for its acknowledgment
         print_routing_table();
-        // printf("Broadcasting again to find new route \n");
-        msg_global.is_print_only = false;
-        // send unicast message
-        send_unicast_msg(msg_global, table_entry->next_addr, table_entry);
-        // broadcast_id++;
+        send_unicast_msg(&msg_global, &table_entry1->next_addr);
     }
 	PROCESS_END();
 }
@@ -550,14 +3504,161 @@ PROCESS_THREAD(pt_delete_reverse_pointer, ev, data)
     linkaddr_copy((linkaddr_t *)&dest_addr, &(*((linkaddr_t *)data)));
     etimer_set(&et2, CLOCK_SECOND * ACTIVE_ROUTE_TIMEOUT);
     PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et2));
-    struct table_record filter;
-    linkaddr_copy((linkaddr_t *)&filter.dest_addr, &dest_addr);
-    struct table_record *table_entry = search_row(filter);
+    struct table_record *table_entry = search_row(&dest_addr);
 
     if (table_entry != NULL) {
         list_remove(routing_table, table_entry);
+        memb_free(&routing_table_mem, table_entry);
         printf("Reverse pointer deleted because the node was not on the path of RREP.\n");
         print_routing_table();
     }
 	PROCESS_END();
 }
+
+/**
+ * Writes the routing table to flash when it changed, at most once per SNAPSHOT_INTERVAL
+*/
+PROCESS_THREAD(pt_snapshot, ev, data)
+{
+    static struct etimer et;
+    PROCESS_BEGIN();
+    while (1)
+    {
+        // the first snapshot right after boot stores the sequence number incremented on restore
+        take_snapshot();
+        etimer_set(&et, CLOCK_SECOND * SNAPSHOT_INTERVAL);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+    }
+    PROCESS_END();
+}
+
+/**
+ * Generates data packets to a set of destinations, configured at build time or over the serial line
+*/
+PROCESS_THREAD(pt_traffic, ev, data)
+{
+    PROCESS_BEGIN();
+    while (traffic_dest_count < TRAFFIC_MAX_DESTINATIONS && traffic_dests[traffic_dest_count] != 0) {
+        traffic_dest_count++;
+    }
+    if (is_traffic_source()) {
+        traffic_start();
+    }
+    while (1)
+    {
+        PROCESS_WAIT_EVENT();
+        if (ev == serial_line_event_message) {
+            traffic_command(data);
+        } else if (ev == PROCESS_EVENT_TIMER && data == &traffic_send_timer && traffic_phase != TRAFFIC_PHASE_IDLE) {
+            traffic_send();
+            traffic_schedule();
+        } else if (ev == PROCESS_EVENT_TIMER && data == &traffic_phase_timer) {
+            traffic_next_phase();
+        }
+    }
+    PROCESS_END();
+}
+
+/**
+ * Prints the radio settings once, the shared energest report prints the time the cpu and radio
+ * were on every AODV_ENERGY_INTERVAL seconds
+*/
+PROCESS_THREAD(pt_energy, ev, data)
+{
+    PROCESS_BEGIN();
+    printf("Low power %u, channel check rate %u Hz\n", AODV_LOW_POWER, AODV_CHECK_RATE);
+    energest_report_start(CLOCK_SECOND * AODV_ENERGY_INTERVAL);
+    PROCESS_END();
+}
+
+/**
+ * The time root and every synchronized node send a time beacon every TIMESYNC_INTERVAL seconds,
+ * unless one of its broadcasts carried the time already. The local clock is read every second,
+ * so no rtimer wrap around is missed.
+*/
+PROCESS_THREAD(pt_timesync, ev, data)
+{
+    static struct etimer et;
+    PROCESS_BEGIN();
+    if (linkaddr_node_addr.u8[0] == TIMESYNC_ROOT) {
+        timesync_level = 0;
+    }
+    while (1)
+    {
+        etimer_set(&et, CLOCK_SECOND);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+        timesync_local_time();
+        if (timesync_level != 0 && timesync_is_synced() &&
+            (clock_time_t)(clock_time() - timesync_last_heard) >= CLOCK_SECOND * TIMESYNC_INTERVAL * TIMESYNC_TIMEOUT) {
+            printf("TIMESYNC lost parent %d.%d \n", timesync_parent.u8[0], timesync_parent.u8[1]);
+            timesync_level = TIMESYNC_UNSYNCED;
+        }
+        if (timesync_is_synced() && (clock_time_t)(clock_time() - timesync_last_sent) >= CLOCK_SECOND * TIMESYNC_INTERVAL) {
+            struct timesync_beacon beacon;
+            timesync_stamp(&beacon.level, &beacon.time);
+            packetbuf_copyfrom(&beacon, sizeof(beacon));
+            printf("CTRL beacon level %u \n", beacon.level);
+            broadcast_send(&timesync_bc);
+        }
+    }
+    PROCESS_END();
+}
+
+/**
+ * The sink starts a gradient round every GRADIENT_INTERVAL seconds with a new sequence number,
+ * which makes the rows of all nodes for the sink from older rounds stale
+*/
+PROCESS_THREAD(pt_gradient, ev, data)
+{
+    static struct etimer et;
+    PROCESS_BEGIN();
+    if (!is_sink()) {
+        PROCESS_EXIT();
+    }
+    printf("COLLECT sink, gradient every %u s \n", GRADIENT_INTERVAL);
+    while (1)
+    {
+        seq_no++;
+        struct gradient_beacon beacon = {seq_no, 0, 0};
+        send_gradient(&beacon);
+        etimer_set(&et, CLOCK_SECOND * GRADIENT_INTERVAL);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+    }
+    PROCESS_END();
+}
+
+/**
+ * Reads the sensors every SENSE_INTERVAL seconds
+*/
+PROCESS_THREAD(pt_sense, ev, data)
+{
+    static struct etimer et;
+    PROCESS_BEGIN();
+    printf("SENSE every %u s, %s \n", SENSE_INTERVAL, AODV_SENSING == 2 ? "raw, one frame per reading" : "summary");
+    etimer_set(&et, CLOCK_SECOND * SENSE_INTERVAL);
+    while (1)
+    {
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+        etimer_reset(&et);
+        sense();
+    }
+    PROCESS_END();
+}
+
+/**
+ * Sends a hello every CLUSTER_INTERVAL seconds, the role of this node is updated before
+*/
+PROCESS_THREAD(pt_cluster, ev, data)
+{
+    static struct etimer et;
+    PROCESS_BEGIN();
+    cluster_round = cluster_current_round();
+    while (1)
+    {
+        // hellos of neighbours that start together must not collide
+        etimer_set(&et, CLOCK_SECOND * CLUSTER_INTERVAL - CLOCK_SECOND / 2 + random_rand() % CLOCK_SECOND);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+        send_cluster_hello();
+    }
+    PROCESS_END();
+}
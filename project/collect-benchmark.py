@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""
+Compares the collection tree (make COLLECT=1) with on-demand AODV for sink-bound traffic, or with
+--compare low-power the always-on radio with ContikiMAC (make LOW_POWER=1) for the same traffic, or with
+--compare aggregation the traffic sent frame by frame and batched per next hop (make AGGREGATE=1).
+
+For every topology and mode, aodv.sky is built with all motes but the sink sending to the sink, the
+topology is run headless in Cooja with a script that logs every mote output line, and the log is
+analyzed with analyze-log.py. The result is one line per run with the delivery ratio, the latency of
+the measured traffic, the number of routing messages sent (CTRL lines, gradient beacons included)
+and the radio duty cycle from the Energest reports.
+
+Usage:
+  ./collect-benchmark.py [aodv.csc ...] [--compare collect|low-power|aggregation] [--sink 8] [--interval 1000]
+                         [--warmup 30] [--duration 300]
+
+CONTIKI must point to the Contiki tree, as for make. The positions and radio medium are taken from
+the given .csc files, their mote types are replaced by the aodv.sky firmware built here.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import xml.etree.ElementTree as ElementTree
+
+PROJECT_DIR = os.path.dirname(os.path.abspath(__file__))
+# the builds compared, with the make variables that select them
+COMPARISONS = {
+    'collect': [('aodv', {'COLLECT': 0}), ('collect', {'COLLECT': 1})],
+    'low-power': [('always-on', {'LOW_POWER': 0}), ('contikimac', {'LOW_POWER': 1})],
+    'aggregation': [('direct', {'AGGREGATE': 0}), ('aggregated', {'AGGREGATE': 1})],
+}
+# seconds the simulation runs after the measured phase, for the last packets to arrive
+DRAIN = 20
+
+SCRIPT = '''/* Writes every mote output line to COOJA.testlog */
+TIMEOUT(%d, log.testOK());
+while (true) {
+  log.log(time + ":" + id + ":" + msg + "\\n");
+  YIELD();
+}'''
+
+
+def mote_ids(root):
+    ids = []
+    for config in root.iter('interface_config'):
+        if config.text and config.text.strip().endswith('MoteID'):
+            ids.append(int(config.find('id').text))
+    return ids
+
+
+def benchmark_csc(topology, timeout_ms):
+    """Copy of the topology that runs aodv.sky and logs to COOJA.testlog, written next to aodv.sky"""
+    tree = ElementTree.parse(topology)
+    root = tree.getroot()
+    for motetype in root.iter('motetype'):
+        for tag in ('source', 'commands'):
+            for element in motetype.findall(tag):
+                motetype.remove(element)
+        firmware = motetype.find('firmware')
+        if firmware is not None:
+            firmware.text = '[CONFIG_DIR]/aodv.sky'
+    for plugin in root.findall('plugin'):
+        root.remove(plugin)
+    plugin = ElementTree.SubElement(root, 'plugin')
+    plugin.text = 'org.contikios.cooja.plugins.ScriptRunner'
+    config = ElementTree.SubElement(plugin, 'plugin_config')
+    ElementTree.SubElement(config, 'script').text = SCRIPT % timeout_ms
+    ElementTree.SubElement(config, 'active').text = 'true'
+    handle, path = tempfile.mkstemp(suffix='.csc', prefix='collect-benchmark-', dir=PROJECT_DIR)
+    os.close(handle)
+    tree.write(path, encoding='UTF-8', xml_declaration=True)
+    return path, mote_ids(root)
+
+
+def build(variables, sources, args):
+    make = ['make', '-C', PROJECT_DIR, 'TARGET=sky']
+    subprocess.run(make + ['clean'], check=True, stdout=subprocess.DEVNULL)
+    options = ['%s=%s' % kv for kv in sorted(variables.items())]
+    subprocess.run(make + ['aodv.sky'] + options +
+                   ['TRAFFIC_SOURCES=%s' % ','.join(str(i) for i in sources),
+                    'TRAFFIC_DESTINATIONS=%d' % args.sink, 'SINK_ID=%d' % args.sink,
+                    'TRAFFIC_INTERVAL=%d' % args.interval,
+                    'TRAFFIC_WARMUP=%d' % args.warmup, 'TRAFFIC_DURATION=%d' % args.duration],
+                   check=True, stdout=subprocess.DEVNULL)
+
+
+def run(topology, mode, variables, args):
+    csc, ids = benchmark_csc(topology, (args.warmup + args.duration + DRAIN) * 1000)
+    try:
+        sources = [i for i in ids if i != args.sink]
+        build(variables, sources, args)
+        with tempfile.TemporaryDirectory() as workdir:
+            subprocess.run(['java', '-mx512m', '-jar', os.path.join(args.contiki, 'tools/cooja/dist/cooja.jar'),
+                            '-nogui=' + csc, '-contiki=' + args.contiki],
+                           cwd=workdir, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+            log = os.path.join(workdir, 'COOJA.testlog')
+            if not os.path.exists(log):
+                sys.exit('Cooja wrote no log for %s in %s mode' % (topology, mode))
+            out = subprocess.run([os.path.join(PROJECT_DIR, 'analyze-log.py'), log, '--csc', topology, '--json'],
+                                 check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+    finally:
+        os.remove(csc)
+    return summarize(json.loads(out))
+
+
+def summarize(result):
+    sent = sum(f['sent'] for f in result['flows'])
+    delivered = sum(f['delivered'] for f in result['flows'])
+    # mean latency over all delivered packets, the p95 of the worst flow
+    weighted = [(f['latency_ms']['mean'], f['delivered']) for f in result['flows'] if f['latency_ms']['mean'] is not None]
+    p95 = [f['latency_ms']['p95'] for f in result['flows'] if f['latency_ms']['p95'] is not None]
+    control = result['control']
+    return {
+        'sent': sent, 'delivered': delivered,
+        'pdr': round(delivered / sent, 4) if sent else None,
+        'latency_mean_ms': round(sum(m * n for m, n in weighted) / delivered, 3) if delivered else None,
+        'latency_p95_max_ms': max(p95) if p95 else None,
+        'control': control['total'],
+        'control_by_type': control['by_type'],
+        'control_per_delivered': control['per_delivered_packet'],
+        'radio_duty_cycle_percent': result['energy']['radio_duty_cycle_percent'],
+        'power_uw_mean': result['energy']['power_uw_mean'],
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Collection tree against on-demand AODV for sink-bound traffic')
+    parser.add_argument('topologies', nargs='*', default=[os.path.join(PROJECT_DIR, 'aodv.csc')],
+                        help='simulation files (default aodv.csc)')
+    parser.add_argument('--compare', choices=sorted(COMPARISONS), default='collect',
+                        help='builds to compare (default collect)')
+    parser.add_argument('--sink', type=int, default=8, help='node id of the sink (default 8)')
+    parser.add_argument('--interval', type=int, default=1000, help='ms between two packets of a source (default 1000)')
+    parser.add_argument('--warmup', type=int, default=30, help='seconds of unmeasured traffic (default 30)')
+    parser.add_argument('--duration', type=int, default=300, help='seconds of measured traffic (default 300)')
+    parser.add_argument('--contiki', default=os.environ.get('CONTIKI'), help='Contiki tree (default $CONTIKI)')
+    parser.add_argument('--json', action='store_true', help='print the results as JSON')
+    args = parser.parse_args()
+    if not args.contiki:
+        sys.exit('CONTIKI not defined')
+
+    results = []
+    for topology in args.topologies:
+        for mode, variables in COMPARISONS[args.compare]:
+            result = run(os.path.abspath(topology), mode, variables, args)
+            result.update({'topology': os.path.basename(topology), 'mode': mode})
+            results.append(result)
+
+    if args.json:
+        json.dump(results, sys.stdout, indent=2)
+        print()
+        return
+    print('topology              mode        sent  deliv    pdr   mean ms  p95 ms  control  per packet  radio %')
+    for r in results:
+        print('%-20s  %-10s  %5d  %5d  %s  %s  %s  %7d  %10s  %7s' % (
+            r['topology'], r['mode'], r['sent'], r['delivered'],
+            '%5.3f' % r['pdr'] if r['pdr'] is not None else '    -',
+            '%8.1f' % r['latency_mean_ms'] if r['latency_mean_ms'] is not None else '       -',
+            '%6.1f' % r['latency_p95_max_ms'] if r['latency_p95_max_ms'] is not None else '     -',
+            r['control'], r['control_per_delivered'] if r['control_per_delivered'] is not None else '-',
+            '%7.3f' % r['radio_duty_cycle_percent'] if r['radio_duty_cycle_percent'] is not None else '-'))
+    print()
+    for r in results:
+        print('%s %s control: %s' % (r['topology'], r['mode'],
+                                     ', '.join('%s %d' % kv for kv in sorted(r['control_by_type'].items()))))
+
+
+if __name__ == '__main__':
+    main()
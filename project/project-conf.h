@@ -0,0 +1,56 @@
+#ifndef PROJECT_CONF_H_
+#define PROJECT_CONF_H_
+
+/**
+ * Radio duty cycling of the AODV nodes, selected from the Makefile (make LOW_POWER=1 CHECK_RATE=8)
+ *  0 - always-on radio (nullrdc). This is a change: the sky platform defaults to ContikiMAC,
+ *      which is what aodv.c ran with before it had a project-conf.h
+ *  1 - ContikiMAC with phase optimization, the wake-up phase of every neighbour is learned
+ *      from its link layer acks, so unicasts along a route start their strobe just before
+ *      the neighbour wakes up instead of strobing for a full wake-up interval
+ */
+#ifndef AODV_LOW_POWER
+#define AODV_LOW_POWER 0
+#endif
+
+/* Channel check rate in Hz (must be a power of two), only used with LOW_POWER=1 */
+#ifndef AODV_CHECK_RATE
+#define AODV_CHECK_RATE 8
+#endif
+
+#undef NETSTACK_CONF_RDC
+#undef NETSTACK_CONF_MAC
+#undef NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE
+
+#if AODV_LOW_POWER
+#define NETSTACK_CONF_RDC contikimac_driver
+#undef CONTIKIMAC_CONF_WITH_PHASE_OPTIMIZATION
+#define CONTIKIMAC_CONF_WITH_PHASE_OPTIMIZATION 1
+/* Room for the phase of every neighbour the AODV link estimator keeps (NEIGHBOUR_TABLE_SIZE) */
+#undef NBR_TABLE_CONF_MAX_NEIGHBORS
+#define NBR_TABLE_CONF_MAX_NEIGHBORS 16
+#else
+#define NETSTACK_CONF_RDC nullrdc_driver
+/**
+ * Without it nullrdc never waits for the link layer ack, every unicast is reported as
+ * MAC_TX_OK after one transmission, which hides broken links from the RREP blacklist
+ * and makes every ETX sample 1
+ */
+#undef NULLRDC_CONF_802154_AUTOACK
+#define NULLRDC_CONF_802154_AUTOACK 1
+#endif
+
+#define NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE AODV_CHECK_RATE
+
+/**
+ * CSMA retransmits unicasts that were not acknowledged, the number of transmissions
+ * it reports is the ETX sample of the link estimator
+ */
+#define NETSTACK_CONF_MAC csma_driver
+
+/* Print the energest report every AODV_ENERGY_INTERVAL seconds */
+#ifndef AODV_ENERGY_INTERVAL
+#define AODV_ENERGY_INTERVAL 10
+#endif
+
+#endif /* PROJECT_CONF_H_ */
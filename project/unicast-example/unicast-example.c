@@ -31,7 +31,18 @@
  */
 /**
  * \file
- *         Best-effort single-hop unicast example
+ *         Single-hop Rime benchmark, based on the best-effort unicast example.
+ *
+ *         The sender measures the highest sustained packet rate and the goodput
+ *         per payload size, and the round-trip time, of unicast, broadcast and
+ *         reliable unicast (runicast) towards the responder. Every result is one
+ *         "BENCH ..." line, "BENCH done" ends the run.
+ *
+ *         Throughput: the sender sends the next packet as soon as the MAC layer
+ *         is done with the previous one, for BENCH_DURATION seconds. The
+ *         responder reports what arrived when no packet came for a second.
+ *         Round-trip time: BENCH_PINGS pings, answered by the responder over
+ *         the same primitive, timed with the rtimer.
  * \author
  *         Adam Dunkels <adam@sics.se>
  */
@@ -40,64 +51,314 @@
 #include "dev/button-sensor.h"
 #include "dev/leds.h"
 #include <stdio.h>
+#include <string.h>
+
+/* Node ids (first byte of the address) of the two roles, other nodes stay quiet */
+#ifndef BENCH_SENDER
+#define BENCH_SENDER 2
+#endif
+#ifndef BENCH_RESPONDER
+#define BENCH_RESPONDER 1
+#endif
+
+/* Seconds to wait after boot before the benchmark starts */
+#define BENCH_START_DELAY 5
+/* Seconds of back-to-back sending per primitive and payload size */
+#define BENCH_DURATION 5
+/* Number of round-trip measurements per primitive */
+#define BENCH_PINGS 50
+/* Time after which a ping without answer counts as lost */
+#define BENCH_PING_TIMEOUT (CLOCK_SECOND / 2)
+/* Time between two pings */
+#define BENCH_PING_INTERVAL (CLOCK_SECOND / 8)
+/* The responder reports a throughput run when no packet came for this long */
+#define BENCH_IDLE_TIMEOUT CLOCK_SECOND
+/* Maximum retransmissions of runicast */
+#define BENCH_RUNICAST_RETRIES 4
+
+#define BENCH_UNICAST 0
+#define BENCH_BROADCAST 1
+#define BENCH_RUNICAST 2
+#define BENCH_MODES 3
+
+#define BENCH_TYPE_DATA 0
+#define BENCH_TYPE_PING 1
+#define BENCH_TYPE_PONG 2
+
+static const char *mode_names[BENCH_MODES] = {"unicast", "broadcast", "runicast"};
+/* Payload sizes of the throughput runs, the largest still fits an 802.15.4 frame with all headers */
+static const uint8_t payload_sizes[] = {8, 32, 64, 80};
+
+/* Header of every benchmark packet, the rest of the payload is filler */
+struct bench_msg {
+  uint8_t type;        /* BENCH_TYPE_DATA, BENCH_TYPE_PING or BENCH_TYPE_PONG */
+  uint8_t mode;        /* primitive the packet was sent with */
+  uint16_t seq;        /* sequence number within the run */
+  rtimer_clock_t time; /* rtimer time the ping was sent, echoed in the pong */
+};
 
 /*---------------------------------------------------------------------------*/
-PROCESS(example_unicast_process, "Unicast example");
+PROCESS(example_unicast_process, "Rime benchmark");
 AUTOSTART_PROCESSES(&example_unicast_process);
 
 /*---------------------------------------------------------------------------*/
-/* 
- * Define callbacks function
- * Called when a packet has been received by the broadcast module
+static struct unicast_conn uc;
+static struct broadcast_conn bc;
+static struct runicast_conn rc;
+
+/* Sender: set by the sent callbacks and the pong, the process waits for it */
+static uint8_t mac_done;
+static uint16_t pong_seq;
+static rtimer_clock_t pong_time;
+static uint8_t pong_received;
+
+/* Responder: the throughput run being received */
+static struct {
+  uint8_t mode;
+  uint8_t size;
+  uint16_t packets;
+  uint32_t bytes;
+  clock_time_t first;
+  clock_time_t last;
+} run;
+static struct ctimer idle_timer;
+
+/*---------------------------------------------------------------------------*/
+static void
+report_run(void *ptr)
+{
+  clock_time_t duration = run.last - run.first;
+  if(run.packets == 0) {
+    return;
+  }
+  /* the first packet opens the interval, its bytes are not part of the rate */
+  printf("BENCH rx mode %s size %u packets %u bytes %lu duration_ms %lu goodput_bps %lu\n",
+         mode_names[run.mode], run.size, run.packets, run.bytes,
+         (unsigned long)duration * 1000 / CLOCK_SECOND,
+         duration > 0 ? (run.bytes - run.size) * 8 * CLOCK_SECOND / duration : 0);
+  run.packets = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_packet(uint8_t mode, const linkaddr_t *to)
+{
+  if(mode == BENCH_UNICAST) {
+    unicast_send(&uc, to);
+  } else if(mode == BENCH_BROADCAST) {
+    broadcast_send(&bc);
+  } else {
+    runicast_send(&rc, to, BENCH_RUNICAST_RETRIES);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Common receive function of the three primitives
  */
 static void
-unicast_recv(struct unicast_conn *c, const linkaddr_t *from) {
-    printf("unicast message received from %d.%d: '%s'\n",
-           from->u8[0], from->u8[1], (char*)packetbuf_dataptr());
+bench_recv(uint8_t mode, const linkaddr_t *from)
+{
+  struct bench_msg msg;
+  uint8_t len = packetbuf_datalen();
+  if(len < sizeof(msg)) {
+    return;
+  }
+  memcpy(&msg, packetbuf_dataptr(), sizeof(msg));
+
+  if(msg.type == BENCH_TYPE_PONG) {
+    pong_seq = msg.seq;
+    pong_time = msg.time;
+    pong_received = 1;
+    process_poll(&example_unicast_process);
+  } else if(msg.type == BENCH_TYPE_PING && linkaddr_node_addr.u8[0] == BENCH_RESPONDER) {
+    /* answer over the same primitive, the packet is still in packetbuf */
+    ((struct bench_msg *)packetbuf_dataptr())->type = BENCH_TYPE_PONG;
+    send_packet(mode, from);
+  } else if(msg.type == BENCH_TYPE_DATA && linkaddr_node_addr.u8[0] == BENCH_RESPONDER) {
+    if(run.packets > 0 && (run.mode != mode || run.size != len)) {
+      report_run(NULL);
+    }
+    if(run.packets == 0) {
+      run.mode = mode;
+      run.size = len;
+      run.bytes = 0;
+      run.first = clock_time();
+    }
+    run.packets++;
+    run.bytes += len;
+    run.last = clock_time();
+    ctimer_set(&idle_timer, BENCH_IDLE_TIMEOUT, report_run, NULL);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+unicast_recv(struct unicast_conn *c, const linkaddr_t *from)
+{
+  bench_recv(BENCH_UNICAST, from);
+}
+static void
+broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
+{
+  bench_recv(BENCH_BROADCAST, from);
+}
+static void
+runicast_recv(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
+{
+  bench_recv(BENCH_RUNICAST, from);
+}
+/*---------------------------------------------------------------------------*/
+static void
+unicast_sent(struct unicast_conn *c, int status, int num_tx)
+{
+  mac_done = 1;
+  process_poll(&example_unicast_process);
+}
+static void
+broadcast_sent(struct broadcast_conn *c, int status, int num_tx)
+{
+  mac_done = 1;
+  process_poll(&example_unicast_process);
+}
+static void
+runicast_sent(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+{
+  mac_done = 1;
+  process_poll(&example_unicast_process);
+}
+static void
+runicast_timedout(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+{
+  mac_done = 1;
+  process_poll(&example_unicast_process);
 }
 
-static const struct unicast_callbacks unicast_cb = {unicast_recv};
+static const struct unicast_callbacks unicast_cb = {unicast_recv, unicast_sent};
+static const struct broadcast_callbacks broadcast_cb = {broadcast_recv, broadcast_sent};
+static const struct runicast_callbacks runicast_cb = {runicast_recv, runicast_sent, runicast_timedout};
 
 /*---------------------------------------------------------------------------*/
-/* Unicast connection */
-static struct unicast_conn uc;
+static void
+prepare_packet(uint8_t type, uint8_t mode, uint16_t seq, uint8_t len)
+{
+  struct bench_msg *msg;
+  packetbuf_clear();
+  packetbuf_set_datalen(len);
+  msg = packetbuf_dataptr();
+  memset(msg, 0x55, len);
+  msg->type = type;
+  msg->mode = mode;
+  msg->seq = seq;
+  msg->time = RTIMER_NOW();
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Sort the round-trip times to read the percentiles
+ */
+static void
+sort_samples(uint16_t *samples, uint8_t count)
+{
+  uint8_t i, j;
+  for(i = 1; i < count; i++) {
+    uint16_t v = samples[i];
+    for(j = i; j > 0 && samples[j - 1] > v; j--) {
+      samples[j] = samples[j - 1];
+    }
+    samples[j] = v;
+  }
+}
 
+static unsigned long
+ticks_to_us(uint16_t ticks)
+{
+  return (unsigned long)ticks * 1000000 / RTIMER_SECOND;
+}
+/*---------------------------------------------------------------------------*/
 PROCESS_THREAD(example_unicast_process, ev, data) {
-    static struct etimer et;
-    
-    PROCESS_EXITHANDLER(unicast_close(&uc);)
-    PROCESS_BEGIN();
-    
-    /* 
-     * Set up a unicast connection
-     * Arguments: channel (146) and callbacks function
-     */
-    unicast_open(&uc, 146, &unicast_cb);
-    
-    /*
-     * Send unicast packet to node "1.0" every 2 seconds
-     * e.g. "2.0" --> "1.0", "3.0" --> "1.0"
-     */
+  static struct etimer et;
+  static linkaddr_t responder;
+  static uint8_t mode, size_index, count;
+  static uint16_t seq, sent;
+  static clock_time_t start;
+  static uint16_t samples[BENCH_PINGS];
+
+  PROCESS_EXITHANDLER(unicast_close(&uc); broadcast_close(&bc); runicast_close(&rc);)
+  PROCESS_BEGIN();
+
+  /*
+   * Set up the three connections
+   * Arguments: channel and callbacks function
+   */
+  unicast_open(&uc, 146, &unicast_cb);
+  broadcast_open(&bc, 129, &broadcast_cb);
+  runicast_open(&rc, 144, &runicast_cb);
+
+  responder.u8[0] = BENCH_RESPONDER;
+  responder.u8[1] = 0;
+
+  if(linkaddr_node_addr.u8[0] != BENCH_SENDER) {
+    /* the responder works in the receive callbacks */
     while(1) {
-        /* Delay 2 seconds */
-        etimer_set(&et, CLOCK_SECOND * 2);
+      PROCESS_WAIT_EVENT();
+    }
+  }
+
+  etimer_set(&et, CLOCK_SECOND * BENCH_START_DELAY);
+  PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+  printf("BENCH start sender %u responder %u duration %u pings %u\n",
+         BENCH_SENDER, BENCH_RESPONDER, BENCH_DURATION, BENCH_PINGS);
+
+  for(mode = 0; mode < BENCH_MODES; mode++) {
+    /* throughput: the next packet goes out as soon as the previous one is done */
+    for(size_index = 0; size_index < sizeof(payload_sizes); size_index++) {
+      sent = 0;
+      start = clock_time();
+      etimer_set(&et, CLOCK_SECOND * BENCH_DURATION);
+      while(!etimer_expired(&et)) {
+        mac_done = 0;
+        prepare_packet(BENCH_TYPE_DATA, mode, sent, payload_sizes[size_index]);
+        send_packet(mode, &responder);
+        PROCESS_WAIT_EVENT_UNTIL(mac_done || etimer_expired(&et));
+        sent++;
+      }
+      printf("BENCH tx mode %s size %u sent %u duration_ms %lu pps %lu\n",
+             mode_names[mode], payload_sizes[size_index], sent,
+             (unsigned long)(clock_time() - start) * 1000 / CLOCK_SECOND,
+             (unsigned long)sent * CLOCK_SECOND / (clock_time() - start));
+      /* let the last packet and the report of the responder through */
+      etimer_set(&et, 2 * BENCH_IDLE_TIMEOUT);
+      PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+      while(runicast_is_transmitting(&rc)) {
+        etimer_set(&et, CLOCK_SECOND / 8);
         PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
-        
-        /* Copy data to the packet buffer */
-        packetbuf_copyfrom("Hello", 6);
-        
-        /* Set RIME address of destination node (1.0) */
-        linkaddr_t addr;
-        addr.u8[0] = 1;
-        addr.u8[1] = 0;
-        
-        /* linkaddr_node_addr: RIME address of the current node */
-        /* Sender's address must be different from destination address */
-        if (!linkaddr_cmp(&addr, &linkaddr_node_addr)) {
-            unicast_send(&uc, &addr);
-        }
+      }
     }
-    
-    PROCESS_END();
+
+    /* round-trip time with the smallest packets */
+    count = 0;
+    for(seq = 0; seq < BENCH_PINGS; seq++) {
+      pong_received = 0;
+      prepare_packet(BENCH_TYPE_PING, mode, seq, sizeof(struct bench_msg));
+      send_packet(mode, &responder);
+      etimer_set(&et, BENCH_PING_TIMEOUT);
+      PROCESS_WAIT_EVENT_UNTIL((pong_received && pong_seq == seq) || etimer_expired(&et));
+      if(pong_received && pong_seq == seq) {
+        samples[count++] = RTIMER_NOW() - pong_time;
+      }
+      etimer_set(&et, BENCH_PING_INTERVAL);
+      PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+    }
+    sort_samples(samples, count);
+    if(count > 0) {
+      printf("BENCH rtt mode %s samples %u lost %u min_us %lu p50_us %lu p90_us %lu p99_us %lu max_us %lu\n",
+             mode_names[mode], count, BENCH_PINGS - count,
+             ticks_to_us(samples[0]), ticks_to_us(samples[count / 2]),
+             ticks_to_us(samples[count * 9 / 10]), ticks_to_us(samples[count * 99 / 100]),
+             ticks_to_us(samples[count - 1]));
+    } else {
+      printf("BENCH rtt mode %s samples 0 lost %u\n", mode_names[mode], BENCH_PINGS);
+    }
+  }
+  printf("BENCH done\n");
+
+  PROCESS_END();
 }
 /*---------------------------------------------------------------------------*/
@@ -167,5 +167,27 @@
     <location_x>680</location_x>
     <location_y>0</location_y>
   </plugin>
+  <plugin>
+    org.contikios.cooja.plugins.ScriptRunner
+    <plugin_config>
+      <script>/* Headless benchmark run: cooja -nogui=unicast-example.csc writes the BENCH lines to COOJA.testlog */
+TIMEOUT(600000);
+while (true) {
+  if (msg.startsWith("BENCH")) {
+    log.log(time + ":" + id + ":" + msg + "\n");
+  }
+  if (msg.equals("BENCH done")) {
+    log.testOK();
+  }
+  YIELD();
+}</script>
+      <active>true</active>
+    </plugin_config>
+    <width>600</width>
+    <z>5</z>
+    <height>400</height>
+    <location_x>680</location_x>
+    <location_y>160</location_y>
+  </plugin>
 </simconf>
 